@@ -0,0 +1,477 @@
+#include "cosmic/binlog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace cosmic {
+
+/**
+ * @brief Static metadata of every LOG_BIN call site in the process.
+ */
+struct BinLogSite {
+  LogLevel level;
+  const char* file;
+  int32_t line;
+  const char* format;
+};
+
+static Mutex<std::vector<BinLogSite>>& GetSites() {
+  static Mutex<std::vector<BinLogSite>> s_sites{std::vector<BinLogSite>{}};
+  return s_sites;
+}
+
+static std::atomic<uint64_t> s_binlogger_id{0};
+// bumped by every destroyed BinLogger, thread caches then drop its buffers
+static std::atomic<uint64_t> s_binlogger_generation{0};
+
+BinLogBuffer::BinLogBuffer(size_t capacity) {
+  size_t size = 4096;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  m_capacity = size;
+  m_data.reset(new char[size]);
+}
+
+char* BinLogBuffer::reserve(size_t size) {
+  uint64_t head = m_head.load(std::memory_order_relaxed);
+  uint64_t tail = m_tail.load(std::memory_order_acquire);
+  size_t pos = head & (m_capacity - 1);
+  size_t toEnd = m_capacity - pos;
+
+  if (size > toEnd) {
+    // records never wrap, fill the end of the ring with a padding entry
+    if (head + toEnd + size - tail > m_capacity) {
+      return nullptr;
+    }
+    uint32_t len = toEnd;
+    uint32_t site = binlog::kPadding;
+    std::memcpy(m_data.get() + pos, &len, 4);
+    std::memcpy(m_data.get() + pos + 4, &site, 4);
+    commit(toEnd);
+    head += toEnd;
+    pos = 0;
+  }
+  if (head + size - tail > m_capacity) {
+    return nullptr;
+  }
+  return m_data.get() + pos;
+}
+
+void BinLogBuffer::detach() {
+  // the producer thread never logs into a destroyed logger
+  m_data.reset();
+  m_detached.store(true, std::memory_order_release);
+}
+
+size_t BinLogBuffer::peek(const char** first, size_t* firstLen,
+                          const char** second, size_t* secondLen) const {
+  uint64_t head = m_head.load(std::memory_order_acquire);
+  uint64_t tail = m_tail.load(std::memory_order_relaxed);
+  size_t size = head - tail;
+  size_t pos = tail & (m_capacity - 1);
+  *first = m_data.get() + pos;
+  *firstLen = std::min(size, m_capacity - pos);
+  *second = m_data.get();
+  *secondLen = size - *firstLen;
+  return size;
+}
+
+BinLogger::BinLogger(const std::string& name, const std::string& path,
+                     LogLevel level, size_t threadBufferSize)
+    : m_name(name), m_id(s_binlogger_id.fetch_add(1) + 1),
+      m_threadBufferSize(threadBufferSize), m_level(level) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("BinLogger open error: " + path);
+  }
+
+  std::string header{binlog::kMagic, sizeof(binlog::kMagic)};
+  uint16_t nameLen = m_name.size();
+  header.append((const char*)&nameLen, 2);
+  header.append(m_name);
+  header.resize(binlog::Align(header.size()), '\0');
+  if (write(fd, header.data(), header.size()) != (ssize_t)header.size()) {
+    close(fd);
+    throw std::runtime_error("BinLogger write error: " + path);
+  }
+  m_output.lock()->fd = fd;
+
+  m_thread.reset(new Thread{[this]() { run(); }, "binlog_" + m_name});
+}
+
+BinLogger::~BinLogger() {
+  m_stopping.store(true, std::memory_order_release);
+  m_signal.notify();
+  m_thread->join();
+  drain();
+  close(m_output.lock()->fd);
+
+  // the thread caches keep a husk until their next generation check
+  auto buffers = m_buffers.lock();
+  for (const auto& buffer : *buffers) {
+    buffer->detach();
+  }
+  buffers->clear();
+  s_binlogger_generation.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t BinLogger::RegisterSite(LogLevel level, const char* file,
+                                 int32_t line, const char* format) {
+  auto sites = GetSites().lock();
+  sites->push_back(BinLogSite{level, file, line, format});
+  return sites->size() - 1;
+}
+
+/**
+ * @brief Buffers of the current thread, they are retired on thread exit
+ * and freed by the logger once drained.
+ */
+struct BinLogThreadBuffers {
+  std::vector<std::pair<uint64_t, std::shared_ptr<BinLogBuffer>>> entries;
+  uint64_t generation = 0; // s_binlogger_generation when last pruned
+  ~BinLogThreadBuffers() {
+    for (auto& entry : entries) {
+      entry.second->retire();
+    }
+  }
+};
+
+static thread_local BinLogThreadBuffers t_binlog_buffers;
+
+BinLogBuffer* BinLogger::getThreadBuffer() {
+  uint64_t generation = s_binlogger_generation.load(std::memory_order_acquire);
+  if (t_binlog_buffers.generation != generation) {
+    t_binlog_buffers.generation = generation;
+    std::erase_if(t_binlog_buffers.entries, [](const auto& entry) {
+      return entry.second->isDetached();
+    });
+  }
+  for (auto& entry : t_binlog_buffers.entries) {
+    if (entry.first == m_id) {
+      return entry.second.get();
+    }
+  }
+  auto buffer = std::make_shared<BinLogBuffer>(m_threadBufferSize);
+  m_buffers.lock()->push_back(buffer);
+  t_binlog_buffers.entries.emplace_back(m_id, buffer);
+  return buffer.get();
+}
+
+static void WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+// a readable range of a thread buffer, taken before the site snapshot
+struct BinLogPending {
+  BinLogBuffer* buffer;
+  bool retired;
+  const char* first;
+  const char* second;
+  size_t firstLen;
+  size_t secondLen;
+  size_t size;
+};
+
+void BinLogger::drain() {
+  // serializes drains, registration only takes m_buffers
+  auto output = m_output.lock();
+  std::vector<std::shared_ptr<BinLogBuffer>> buffers = *m_buffers.lock();
+
+  // take the records first: a site is registered before its first record,
+  // so the snapshot below covers every site they refer to
+  std::vector<BinLogPending> pending;
+  pending.reserve(buffers.size());
+  for (const auto& buffer : buffers) {
+    BinLogPending p;
+    p.buffer = buffer.get();
+    p.retired = buffer->isRetired();
+    p.size = buffer->peek(&p.first, &p.firstLen, &p.second, &p.secondLen);
+    pending.push_back(p);
+  }
+
+  // metadata goes out before any record that refers to it
+  std::string meta;
+  {
+    auto sites = GetSites().lock();
+    for (uint32_t id = output->sites; id < sites->size(); ++id) {
+      const BinLogSite& site = (*sites)[id];
+      size_t begin = meta.size();
+      uint32_t kind = binlog::kSiteMeta;
+      uint8_t level = (uint8_t)site.level;
+      uint16_t fileLen = strlen(site.file);
+      uint16_t fmtLen = strlen(site.format);
+      meta.append(4, '\0');
+      meta.append((const char*)&kind, 4);
+      meta.append((const char*)&id, 4);
+      meta.append((const char*)&level, 1);
+      meta.append((const char*)&site.line, 4);
+      meta.append((const char*)&fileLen, 2);
+      meta.append(site.file, fileLen);
+      meta.append((const char*)&fmtLen, 2);
+      meta.append(site.format, fmtLen);
+      meta.resize(begin + binlog::Align(meta.size() - begin), '\0');
+      uint32_t len = meta.size() - begin;
+      std::memcpy(&meta[begin], &len, 4);
+    }
+    output->sites = sites->size();
+  }
+  WriteFully(output->fd, meta.data(), meta.size());
+
+  for (const BinLogPending& p : pending) {
+    if (p.size == 0) {
+      continue;
+    }
+    struct iovec iov[2] = {{(void*)p.first, p.firstLen},
+                           {(void*)p.second, p.secondLen}};
+    ssize_t n;
+    do {
+      n = writev(output->fd, iov, p.secondLen ? 2 : 1);
+    } while (n < 0 && errno == EINTR);
+    if (n >= 0 && (size_t)n < p.size) {
+      // rare short write, finish it piece by piece
+      size_t done = n;
+      if (done < p.firstLen) {
+        WriteFully(output->fd, p.first + done, p.firstLen - done);
+        done = p.firstLen;
+      }
+      WriteFully(output->fd, p.second + (done - p.firstLen), p.size - done);
+    }
+    p.buffer->consume(p.size);
+  }
+
+  // a retired buffer was complete when peeked, it is fully written now
+  std::vector<BinLogBuffer*> retired;
+  for (const BinLogPending& p : pending) {
+    if (p.retired) {
+      retired.push_back(p.buffer);
+    }
+  }
+  if (!retired.empty()) {
+    std::erase_if(*m_buffers.lock(), [&retired](const auto& buffer) {
+      return std::find(retired.begin(), retired.end(), buffer.get()) !=
+             retired.end();
+    });
+  }
+}
+
+void BinLogger::flush() { drain(); }
+
+void BinLogger::run() {
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    m_signal.waitFor(10);
+    drain();
+  }
+}
+
+BinLogReader::BinLogReader(const std::string& path) {
+  std::ifstream in{path, std::ios::binary};
+  if (!in) {
+    return;
+  }
+  m_data.assign(std::istreambuf_iterator<char>{in},
+                std::istreambuf_iterator<char>{});
+  if (m_data.size() < sizeof(binlog::kMagic) + 2 ||
+      std::memcmp(m_data.data(), binlog::kMagic, sizeof(binlog::kMagic)) !=
+          0) {
+    return;
+  }
+  uint16_t nameLen;
+  std::memcpy(&nameLen, m_data.data() + sizeof(binlog::kMagic), 2);
+  size_t nameBegin = sizeof(binlog::kMagic) + 2;
+  if (nameBegin + nameLen > m_data.size()) {
+    return;
+  }
+  m_name = m_data.substr(nameBegin, nameLen);
+  m_offset = binlog::Align(nameBegin + nameLen);
+  m_valid = true;
+}
+
+template <class T> static bool ReadValue(const char*& p, const char* end,
+                                         T& value) {
+  if (end - p < (ptrdiff_t)sizeof(T)) {
+    return false;
+  }
+  std::memcpy(&value, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+
+// append one argument, return false at the end of the argument list
+static bool AppendArg(LogStream& out, const char*& p, const char* end) {
+  uint8_t type;
+  if (!ReadValue(p, end, type)) {
+    return false;
+  }
+  switch ((binlog::ArgType)type) {
+  case binlog::ArgType::INT: {
+    int64_t v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    out << v;
+    return true;
+  }
+  case binlog::ArgType::UINT: {
+    uint64_t v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    out << v;
+    return true;
+  }
+  case binlog::ArgType::DOUBLE: {
+    double v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr - buf);
+    return true;
+  }
+  case binlog::ArgType::BOOL: {
+    uint8_t v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    out << (v ? "true" : "false");
+    return true;
+  }
+  case binlog::ArgType::CHAR: {
+    char v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    out << v;
+    return true;
+  }
+  case binlog::ArgType::STRING: {
+    uint32_t len;
+    if (!ReadValue(p, end, len) || end - p < (ptrdiff_t)len) {
+      return false;
+    }
+    out.append(p, len);
+    p += len;
+    return true;
+  }
+  case binlog::ArgType::POINTER: {
+    uint64_t v;
+    if (!ReadValue(p, end, v)) {
+      return false;
+    }
+    out << (const void*)(uintptr_t)v;
+    return true;
+  }
+  }
+  // zero padding after the last argument
+  return false;
+}
+
+void BinLogReader::FormatMessage(LogStream& out, std::string_view format,
+                                 const char* args, const char* end) {
+  size_t i = 0;
+  while (i < format.size()) {
+    char c = format[i];
+    if (c == '{' && i + 1 < format.size() && format[i + 1] == '{') {
+      out << '{';
+      i += 2;
+    } else if (c == '}' && i + 1 < format.size() && format[i + 1] == '}') {
+      out << '}';
+      i += 2;
+    } else if (c == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+      if (!AppendArg(out, args, end)) {
+        out << "{}";
+      }
+      i += 2;
+    } else {
+      out << c;
+      ++i;
+    }
+  }
+}
+
+bool BinLogReader::decode(const LogFormatter& formatter, std::ostream& os) {
+  if (!m_valid) {
+    return false;
+  }
+  Logger logger{m_name};
+  LogEvent event;
+  LogStream line;
+
+  while (m_offset + 8 <= m_data.size()) {
+    const char* entry = m_data.data() + m_offset;
+    uint32_t len, site;
+    std::memcpy(&len, entry, 4);
+    std::memcpy(&site, entry + 4, 4);
+    if (len < 8 || len % 8 != 0 || m_offset + len > m_data.size()) {
+      // torn tail of a log which is still being written
+      return false;
+    }
+    const char* p = entry + 8;
+    const char* end = entry + len;
+    m_offset += len;
+
+    if (site == binlog::kPadding) {
+      continue;
+    }
+    if (site == binlog::kSiteMeta) {
+      uint32_t id;
+      uint8_t level;
+      int32_t lineNo;
+      uint16_t fileLen, fmtLen;
+      if (!ReadValue(p, end, id) || !ReadValue(p, end, level) ||
+          !ReadValue(p, end, lineNo) || !ReadValue(p, end, fileLen) ||
+          end - p < fileLen) {
+        return false;
+      }
+      std::string file{p, fileLen};
+      p += fileLen;
+      if (!ReadValue(p, end, fmtLen) || end - p < fmtLen) {
+        return false;
+      }
+      if (id >= m_sites.size()) {
+        m_sites.resize(id + 1);
+      }
+      m_sites[id] = Site{(LogLevel)level, lineNo, file, {p, fmtLen}};
+      continue;
+    }
+
+    uint64_t timeUs;
+    uint32_t threadId;
+    if (site >= m_sites.size() || !ReadValue(p, end, timeUs) ||
+        !ReadValue(p, end, threadId)) {
+      return false;
+    }
+    const Site& meta = m_sites[site];
+    event.reset(meta.level, meta.file.c_str(), meta.line, 0, threadId, 0,
+                timeUs);
+    FormatMessage(event.getStream(), meta.format, p, end);
+
+    line.reset();
+    formatter.formatTo(line, logger, event);
+    os.write(line.data(), line.size());
+  }
+  return true;
+}
+
+} // namespace cosmic
@@ -0,0 +1,149 @@
+#include "cosmic/clock.h"
+
+#include <atomic>
+#include <time.h>
+
+#ifdef COSMIC_HAVE_TSC
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+namespace cosmic {
+
+static uint64_t ReadNs(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef COSMIC_HAVE_TSC
+
+static uint64_t ReadRealtimeNs() { return ReadNs(CLOCK_REALTIME); }
+
+TscClock::TscClock(WallClock wall)
+    : m_wall(wall ? wall : ReadRealtimeNs), m_enabled(HasInvariantTsc()) {
+  if (m_enabled) {
+    calibrate();
+  }
+}
+
+uint64_t TscClock::nowNs() {
+  uint64_t tsc = __rdtsc();
+  for (;;) {
+    uint64_t seq = m_seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      continue; // a resync is being published
+    }
+    uint64_t baseTsc = m_baseTsc.load(std::memory_order_relaxed);
+    uint64_t baseNs = m_baseNs.load(std::memory_order_relaxed);
+    double nsPerTick = m_nsPerTick.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_seq.load(std::memory_order_relaxed) != seq) {
+      continue;
+    }
+    // a thread that read the tsc before the last resync lands here
+    uint64_t ticks = tsc > baseTsc ? tsc - baseTsc : 0;
+    if (ticks * nsPerTick >= kResyncNs) {
+      return resync(seq);
+    }
+    return baseNs + (uint64_t)(ticks * nsPerTick);
+  }
+}
+
+bool TscClock::HasInvariantTsc() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return edx & (1u << 8);
+}
+
+// read the clocks back to back, keep the sample with the tightest bracket
+void TscClock::sample(uint64_t& tsc, uint64_t& wallNs,
+                      uint64_t& rawNs) const {
+  uint64_t best = ~0ull;
+  tsc = wallNs = rawNs = 0;
+  for (int i = 0; i < 5; ++i) {
+    uint64_t before = __rdtsc();
+    uint64_t wall = m_wall();
+    uint64_t raw = ReadNs(CLOCK_MONOTONIC_RAW);
+    uint64_t after = __rdtsc();
+    if (after - before < best) {
+      best = after - before;
+      tsc = before + (after - before) / 2;
+      wallNs = wall;
+      rawNs = raw;
+    }
+  }
+}
+
+void TscClock::calibrate() {
+  uint64_t wallNs;
+  sample(m_firstTsc, wallNs, m_firstRawNs);
+  uint64_t until = ReadNs(CLOCK_MONOTONIC) + 1000000;
+  while (ReadNs(CLOCK_MONOTONIC) < until) {
+  }
+  uint64_t tsc, rawNs;
+  sample(tsc, wallNs, rawNs);
+  if (tsc <= m_firstTsc || rawNs <= m_firstRawNs) {
+    m_enabled = false;
+    return;
+  }
+  m_nsPerTick.store((double)(rawNs - m_firstRawNs) / (tsc - m_firstTsc),
+                    std::memory_order_relaxed);
+  m_baseTsc.store(tsc, std::memory_order_relaxed);
+  m_baseNs.store(wallNs, std::memory_order_relaxed);
+}
+
+uint64_t TscClock::resync(uint64_t seq) {
+  uint64_t tsc, wallNs, rawNs;
+  sample(tsc, wallNs, rawNs);
+  // one thread publishes, the others just use their fresh sample
+  if (m_seq.compare_exchange_strong(seq, seq + 1,
+                                    std::memory_order_acquire)) {
+    // the raw clock is never stepped, only the base follows the wall clock
+    if (tsc > m_firstTsc && rawNs > m_firstRawNs) {
+      m_nsPerTick.store((double)(rawNs - m_firstRawNs) / (tsc - m_firstTsc),
+                        std::memory_order_relaxed);
+    }
+    m_baseTsc.store(tsc, std::memory_order_relaxed);
+    m_baseNs.store(wallNs, std::memory_order_relaxed);
+    m_seq.store(seq + 2, std::memory_order_release);
+  }
+  return wallNs;
+}
+
+static TscClock& GetTscClock() {
+  static TscClock s_clock;
+  return s_clock;
+}
+
+#endif // COSMIC_HAVE_TSC
+
+// captured when the library is loaded
+static const uint64_t s_startMs = ReadNs(CLOCK_MONOTONIC_COARSE) / 1000000;
+
+uint64_t GetCurrentUs() {
+#ifdef COSMIC_HAVE_TSC
+  TscClock& clock = GetTscClock();
+  if (clock.enabled()) {
+    return clock.nowNs() / 1000;
+  }
+#endif
+  return ReadNs(CLOCK_REALTIME_COARSE) / 1000;
+}
+
+uint64_t GetMonotonicUs() { return ReadNs(CLOCK_MONOTONIC) / 1000; }
+
+uint64_t GetCoarseMonotonicUs() {
+  return ReadNs(CLOCK_MONOTONIC_COARSE) / 1000;
+}
+
+uint32_t GetUptimeMs() {
+  if (s_startMs == 0) {
+    return 0; // called before this unit was initialized
+  }
+  return ReadNs(CLOCK_MONOTONIC_COARSE) / 1000000 - s_startMs;
+}
+
+} // namespace cosmic
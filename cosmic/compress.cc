@@ -0,0 +1,258 @@
+#include "cosmic/compress.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace cosmic {
+
+static constexpr size_t kWindowSize = 32 * 1024;
+static constexpr size_t kHashBits = 15;
+static constexpr size_t kHashSize = 1 << kHashBits;
+static constexpr size_t kMinMatch = 3;
+static constexpr size_t kMaxMatch = 258;
+static constexpr int kMaxChain = 32;
+
+// base value and extra bits of length codes 257..285
+static const uint16_t kLengthBase[] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                       11, 13, 15, 17,  19,  23,  27,  31,
+                                       35, 43, 51, 59,  67,  83,  99,  115,
+                                       131, 163, 195, 227, 258};
+static const uint8_t kLengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+// base value and extra bits of distance codes 0..29
+static const uint16_t kDistBase[] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,    25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+static const uint8_t kDistExtra[] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                     4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                     9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t len) {
+  // trivially destructible, appenders may still gzip during static teardown
+  static constexpr auto s_table = []() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i) {
+    crc = s_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+GzipWriter::GzipWriter() {}
+
+void GzipWriter::writeBits(uint32_t bits, int count, std::string& out) {
+  m_bitBuf |= (uint64_t)bits << m_bitCount;
+  m_bitCount += count;
+  while (m_bitCount >= 8) {
+    out.push_back((char)(m_bitBuf & 0xFF));
+    m_bitBuf >>= 8;
+    m_bitCount -= 8;
+  }
+}
+
+// Huffman codes are packed starting from their most significant bit
+void GzipWriter::writeHuffman(uint32_t code, int count, std::string& out) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < count; ++i) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  writeBits(reversed, count, out);
+}
+
+void GzipWriter::writeLiteral(uint8_t c, std::string& out) {
+  if (c < 144) {
+    writeHuffman(0x30 + c, 8, out);
+  } else {
+    writeHuffman(0x190 + (c - 144), 9, out);
+  }
+}
+
+void GzipWriter::writeMatch(uint32_t length, uint32_t distance,
+                            std::string& out) {
+  int lcode = 28;
+  while (kLengthBase[lcode] > length) {
+    --lcode;
+  }
+  uint32_t symbol = 257 + lcode;
+  if (symbol < 280) {
+    writeHuffman(symbol - 256, 7, out);
+  } else {
+    writeHuffman(0xC0 + (symbol - 280), 8, out);
+  }
+  writeBits(length - kLengthBase[lcode], kLengthExtra[lcode], out);
+
+  int dcode = 29;
+  while (kDistBase[dcode] > distance) {
+    --dcode;
+  }
+  writeHuffman(dcode, 5, out);
+  writeBits(distance - kDistBase[dcode], kDistExtra[dcode], out);
+}
+
+static inline uint32_t Hash3(const uint8_t* p) {
+  uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+void GzipWriter::deflateBlock(std::string_view data, bool final,
+                              std::string& out) {
+  // BFINAL, BTYPE = 01 (fixed Huffman codes)
+  writeBits(final ? 1 : 0, 1, out);
+  writeBits(1, 2, out);
+
+  const uint8_t* in = (const uint8_t*)data.data();
+  size_t size = data.size();
+  std::vector<int32_t> head(kHashSize, -1);
+  std::vector<int32_t> prev(kWindowSize, -1);
+
+  size_t pos = 0;
+  while (pos < size) {
+    size_t bestLen = 0;
+    size_t bestDist = 0;
+    if (pos + kMinMatch <= size) {
+      uint32_t h = Hash3(in + pos);
+      int32_t candidate = head[h];
+      size_t maxLen = std::min(kMaxMatch, size - pos);
+      for (int chain = 0; candidate >= 0 && chain < kMaxChain; ++chain) {
+        size_t dist = pos - candidate;
+        if (dist > kWindowSize) {
+          break;
+        }
+        size_t len = 0;
+        while (len < maxLen && in[candidate + len] == in[pos + len]) {
+          ++len;
+        }
+        if (len > bestLen) {
+          bestLen = len;
+          bestDist = dist;
+          if (len == maxLen) {
+            break;
+          }
+        }
+        candidate = prev[candidate % kWindowSize];
+      }
+    }
+
+    size_t step = bestLen >= kMinMatch ? bestLen : 1;
+    if (bestLen >= kMinMatch) {
+      writeMatch(bestLen, bestDist, out);
+    } else {
+      writeLiteral(in[pos], out);
+    }
+    // index every position we pass, later matches may start inside
+    for (size_t i = 0; i < step; ++i, ++pos) {
+      if (pos + kMinMatch <= size) {
+        uint32_t h = Hash3(in + pos);
+        prev[pos % kWindowSize] = head[h];
+        head[h] = (int32_t)pos;
+      }
+    }
+  }
+
+  writeHuffman(0, 7, out); // end of block
+}
+
+void GzipWriter::write(std::string_view data, std::string& out) {
+  if (!m_headerDone) {
+    // magic, CM = deflate, no flags, no mtime, XFL = 0, OS = unix
+    static const char kHeader[] = {'\x1f', '\x8b', 8, 0, 0, 0,
+                                   0,      0,      0, 3};
+    out.append(kHeader, sizeof(kHeader));
+    m_headerDone = true;
+  }
+  if (data.empty()) {
+    return;
+  }
+  m_crc = Crc32(m_crc, data.data(), data.size());
+  m_size += (uint32_t)data.size();
+  deflateBlock(data, false, out);
+}
+
+void GzipWriter::finish(std::string& out) {
+  write({}, out);
+  deflateBlock({}, true, out);
+  if (m_bitCount > 0) {
+    writeBits(0, 8 - m_bitCount, out);
+  }
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((char)((m_crc >> (8 * i)) & 0xFF));
+  }
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((char)((m_size >> (8 * i)) & 0xFF));
+  }
+}
+
+static bool WriteFully(int fd, const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool GzipFile(const std::string& src, const std::string& dst) {
+  int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+
+  GzipWriter writer;
+  std::string buf(1024 * 1024, '\0');
+  std::string compressed;
+  bool ok = true;
+  for (;;) {
+    ssize_t n = read(in, buf.data(), buf.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    compressed.clear();
+    writer.write({buf.data(), (size_t)n}, compressed);
+    if (!WriteFully(out, compressed)) {
+      ok = false;
+      break;
+    }
+  }
+  if (ok) {
+    compressed.clear();
+    writer.finish(compressed);
+    ok = WriteFully(out, compressed);
+  }
+  close(in);
+  close(out);
+  return ok;
+}
+
+} // namespace cosmic
@@ -1,5 +1,475 @@
 #include "cosmic/config.h"
 
+#include "cosmic/clock.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
 namespace cosmic {
-Config::ConfigVarMap Config::s_vars;
+
+using ConfigVarPtr = std::shared_ptr<ConfigVarBase>;
+
+/**
+ * @brief Open addressing table with linear probing, slots point into the
+ * registry's list of vars.
+ *
+ * A slot is filled once: hash first, then var with a release store, so a
+ * reader which sees var also sees hash. Slots are never emptied.
+ */
+struct ConfigVarTable {
+  struct Slot {
+    std::atomic<const ConfigVarPtr*> var{nullptr};
+    size_t hash = 0;
+  };
+
+  explicit ConfigVarTable(size_t size) : slots(size), mask(size - 1) {}
+
+  const ConfigVarPtr* find(std::string_view name, size_t hash) const {
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const ConfigVarPtr* var = slots[i].var.load(std::memory_order_acquire);
+      if (!var) {
+        return nullptr;
+      }
+      if (slots[i].hash == hash && (*var)->getName() == name) {
+        return var;
+      }
+    }
+  }
+
+  // the name must not be in the table yet
+  void insert(const ConfigVarPtr* var, size_t hash) {
+    size_t i = hash & mask;
+    while (slots[i].var.load(std::memory_order_relaxed)) {
+      i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].var.store(var, std::memory_order_release);
+    ++count;
+  }
+
+  std::vector<Slot> slots; // power of two, at most half full
+  size_t mask;
+  size_t count = 0; // written under the registry lock only
+};
+
+/**
+ * @brief Vars by name. Never destroyed: vars are looked up from static
+ * initializers and destructors of other translation units.
+ */
+struct ConfigRegistry {
+  static constexpr size_t kInitialSize = 64;
+
+  RcuPtr<ConfigVarTable> table{new ConfigVarTable{kInitialSize}};
+  // owns the vars, a deque keeps their addresses stable
+  Mutex<std::deque<ConfigVarPtr>> vars{std::deque<ConfigVarPtr>{}};
+};
+
+static ConfigRegistry& GetRegistry() {
+  static ConfigRegistry* s_registry = new ConfigRegistry{};
+  return *s_registry;
+}
+
+std::shared_ptr<ConfigVarBase> Config::LookupBase(std::string_view name) {
+  size_t hash = std::hash<std::string_view>{}(name);
+  Rcu::ReadGuard guard;
+  const ConfigVarPtr* var = GetRegistry().table.load()->find(name, hash);
+  return var ? *var : nullptr;
+}
+
+bool Config::IsValidName(std::string_view name) {
+  return name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQ"
+                                "RSTUVWXYZ._0123456789") ==
+         std::string_view::npos;
+}
+
+std::shared_ptr<ConfigVarBase>
+Config::Register(std::shared_ptr<ConfigVarBase> var) {
+  ConfigRegistry& registry = GetRegistry();
+  size_t hash = std::hash<std::string_view>{}(var->getName());
+  auto vars = registry.vars.lock();
+  // writers are serialized, the table can be read without a guard
+  ConfigVarTable* table = registry.table.load();
+  if (const ConfigVarPtr* found = table->find(var->getName(), hash)) {
+    return *found;
+  }
+  vars->push_back(std::move(var));
+  const ConfigVarPtr* added = &vars->back();
+
+  if ((table->count + 1) * 2 > table->slots.size()) {
+    auto bigger = new ConfigVarTable{table->slots.size() * 2};
+    for (const ConfigVarPtr& v : *vars) {
+      bigger->insert(&v, std::hash<std::string_view>{}(v->getName()));
+    }
+    registry.table.reset(bigger);
+  } else {
+    table->insert(added, hash);
+  }
+  return *added;
+}
+
+using ConfigNotifications = std::vector<std::function<void()>>;
+
+// set once the queue is destroyed at exit, later posts run in place
+static std::atomic<bool> s_config_notify_stopped{false};
+
+/**
+ * @brief Queue of notification batches and the thread running them. A
+ * static, so at exit the thread runs what is queued and is joined before
+ * the vars and loggers constructed earlier are destroyed.
+ */
+struct ConfigNotifyQueue {
+  ConfigNotifyQueue() {
+    thread.reset(new Thread{[this]() { run(); }, "config_notify"});
+  }
+
+  ~ConfigNotifyQueue() {
+    stopping.store(true, std::memory_order_release);
+    signal.notify();
+    // exit() called by a listener cannot wait for itself
+    if (thread->getId() != GetThreadId()) {
+      thread->join();
+    }
+    s_config_notify_stopped.store(true, std::memory_order_release);
+  }
+
+  void push(ConfigNotifications batch) {
+    batches.lock()->push_back(std::move(batch));
+    signal.notify();
+  }
+
+  void run() {
+    for (;;) {
+      signal.wait();
+      for (;;) {
+        std::deque<ConfigNotifications> ready;
+        ready.swap(*batches.lock());
+        if (ready.empty()) {
+          break;
+        }
+        for (const auto& batch : ready) {
+          for (const auto& fn : batch) {
+            try {
+              fn();
+            } catch (std::exception& e) {
+              LOG_ERROR(ROOT_LOGGER())
+                  << "ConfigVar listener exception: " << e.what();
+            }
+          }
+        }
+      }
+      if (stopping.load(std::memory_order_acquire)) {
+        break;
+      }
+    }
+  }
+
+  Mutex<std::deque<ConfigNotifications>> batches{
+      std::deque<ConfigNotifications>{}};
+  std::atomic<bool> stopping{false};
+  Semaphore signal;
+  std::unique_ptr<Thread> thread;
+};
+
+static ConfigNotifyQueue& GetNotifyQueue() {
+  static ConfigNotifyQueue s_queue;
+  return s_queue;
+}
+
+// run the batch on the calling thread once the queue is gone
+static void PushNotifications(ConfigNotifications batch) {
+  if (!s_config_notify_stopped.load(std::memory_order_acquire)) {
+    GetNotifyQueue().push(std::move(batch));
+    return;
+  }
+  for (const auto& fn : batch) {
+    fn();
+  }
+}
+
+// the batch being collected by this thread
+struct ConfigBatchState {
+  int depth = 0;
+  ConfigNotifications notifications;
+};
+
+static thread_local ConfigBatchState t_config_batch;
+
+ConfigDispatcher::Batch::Batch() { ++t_config_batch.depth; }
+
+ConfigDispatcher::Batch::~Batch() {
+  if (--t_config_batch.depth == 0 &&
+      !t_config_batch.notifications.empty()) {
+    PushNotifications(std::move(t_config_batch.notifications));
+    t_config_batch.notifications.clear();
+  }
+}
+
+void ConfigDispatcher::Post(std::function<void()> fn) {
+  if (t_config_batch.depth > 0) {
+    t_config_batch.notifications.push_back(std::move(fn));
+  } else {
+    PushNotifications(ConfigNotifications{std::move(fn)});
+  }
 }
+
+void ConfigDispatcher::Flush() {
+  if (s_config_notify_stopped.load(std::memory_order_acquire)) {
+    return; // posts run in place
+  }
+  auto done = std::make_shared<Semaphore>();
+  // past the batch of this thread, which may still be open
+  GetNotifyQueue().push(ConfigNotifications{[done]() { done->notify(); }});
+  done->wait();
+}
+
+const std::string& ConfigScalarOf(const YAML::Node& node) {
+  static const std::string s_empty;
+  if (node.IsNull()) {
+    return s_empty;
+  }
+  if (!node.IsScalar()) {
+    throw std::invalid_argument("not a scalar");
+  }
+  return node.Scalar();
+}
+
+bool ConfigConverter<bool>::FromString(std::string_view str) {
+  auto is = [str](std::string_view word) {
+    return std::equal(str.begin(), str.end(), word.begin(), word.end(),
+                      [](char a, char b) { return std::tolower(a) == b; });
+  };
+  if (is("true") || is("yes") || is("on") || is("1")) {
+    return true;
+  }
+  if (is("false") || is("no") || is("off") || is("0")) {
+    return false;
+  }
+  throw std::invalid_argument("not a bool: " + std::string{str});
+}
+
+// name holds the dotted path of node, it is restored before returning
+static void ForEachMemberOf(std::string& name, const YAML::Node& node,
+                            const Config::MemberCallback& cb) {
+  if (!name.empty()) {
+    cb(name, node);
+  }
+  if (!node.IsMap()) {
+    return;
+  }
+  size_t length = name.size();
+  for (auto it = node.begin(); it != node.end(); ++it) {
+    const std::string& key = it->first.Scalar();
+    if (length > 0) {
+      name += '.';
+    }
+    name += key;
+    if (Config::IsValidName(key)) {
+      ForEachMemberOf(name, it->second, cb);
+    } else {
+      LOG_ERROR(ROOT_LOGGER()) << "Config invalid name: " << name;
+    }
+    name.resize(length);
+  }
+}
+
+void Config::ForEachMember(const YAML::Node& root, const MemberCallback& cb) {
+  std::string name;
+  ForEachMemberOf(name, root, cb);
+}
+
+void Config::LoadFromYaml(const YAML::Node& root) {
+  ConfigDispatcher::Batch batch;
+  ForEachMember(root, [](std::string_view name, const YAML::Node& node) {
+    if (auto var = LookupBase(name)) {
+      var->fromNode(node);
+    }
+  });
+}
+
+// "dir/name" of a path, the name inotify reports in dir
+static std::pair<std::string, std::string> SplitPath(const std::string& path) {
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos) {
+    return {".", path};
+  }
+  return {slash == 0 ? "/" : path.substr(0, slash), path.substr(slash + 1)};
+}
+
+static std::string JoinPath(const std::string& dir, std::string_view name) {
+  std::string path = dir;
+  if (path.back() != '/') {
+    path += '/';
+  }
+  path += name;
+  return path;
+}
+
+// text of a node to compare two loads by
+static std::string NodeText(const YAML::Node& node) {
+  if (node.IsScalar()) {
+    return node.Scalar();
+  }
+  YAML::Emitter out;
+  out << node;
+  return out.c_str();
+}
+
+ConfigWatcher::ConfigWatcher(uint32_t debounceMs) : m_debounceMs(debounceMs) {
+  m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_inotifyFd < 0 || m_wakeFd < 0) {
+    if (m_inotifyFd >= 0) {
+      close(m_inotifyFd);
+    }
+    if (m_wakeFd >= 0) {
+      close(m_wakeFd);
+    }
+    throw std::runtime_error("ConfigWatcher inotify error");
+  }
+  m_thread.reset(new Thread{[this]() { run(); }, "config_watch"});
+}
+
+ConfigWatcher::~ConfigWatcher() {
+  m_stopping.store(true, std::memory_order_release);
+  uint64_t one = 1;
+  (void)!write(m_wakeFd, &one, sizeof(one));
+  m_thread->join();
+  close(m_inotifyFd);
+  close(m_wakeFd);
+}
+
+bool ConfigWatcher::watch(const std::string& path) {
+  auto [dir, name] = SplitPath(path);
+  std::string file = JoinPath(dir, name);
+  int wd = inotify_add_watch(m_inotifyFd, dir.c_str(),
+                             IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+                                 IN_MOVED_TO);
+  if (wd < 0) {
+    LOG_ERROR(ROOT_LOGGER()) << "ConfigWatcher can't watch " << dir << ": "
+                             << strerror(errno);
+    return false;
+  }
+  {
+    auto state = m_state.lock();
+    state->dirs[wd] = dir;
+    state->files.try_emplace(file);
+  }
+  reload(file);
+  return true;
+}
+
+int ConfigWatcher::reload(const std::string& path) {
+  auto [dir, name] = SplitPath(path);
+  std::string file = JoinPath(dir, name);
+  YAML::Node root;
+  try {
+    root = YAML::LoadFile(file);
+  } catch (std::exception& e) {
+    LOG_ERROR(ROOT_LOGGER())
+        << "ConfigWatcher reload " << file << " error: " << e.what();
+    return -1;
+  }
+
+  auto state = m_state.lock();
+  FileValues& last = state->files[file];
+  FileValues values;
+  std::vector<std::pair<std::shared_ptr<ConfigVarBase>, YAML::Node>> changed;
+  Config::ForEachMember(root, [&](std::string_view key,
+                                  const YAML::Node& node) {
+    auto var = Config::LookupBase(key);
+    if (!var) {
+      return;
+    }
+    std::string text = NodeText(node);
+    auto it = last.find(var->getName());
+    if (it == last.end() || it->second != text) {
+      changed.emplace_back(var, node);
+    }
+    values.emplace(var->getName(), std::move(text));
+  });
+
+  int applied = 0;
+  ConfigDispatcher::Batch batch;
+  for (const auto& [var, node] : changed) {
+    if (var->fromNode(node)) {
+      ++applied;
+    } else {
+      // not recorded, the next load tries again
+      values.erase(var->getName());
+    }
+  }
+  last = std::move(values);
+  m_reloads.fetch_add(1, std::memory_order_relaxed);
+  LOG_INFO(ROOT_LOGGER()) << "ConfigWatcher reload " << file << ": "
+                          << applied << " keys changed";
+  return applied;
+}
+
+void ConfigWatcher::run() {
+  // path -> when to reload it
+  std::unordered_map<std::string, uint64_t> pending;
+  alignas(inotify_event) char buf[4096];
+
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    int timeout = -1;
+    uint64_t now = GetMonotonicUs();
+    for (const auto& [path, due] : pending) {
+      int ms = due > now ? (int)((due - now + 999) / 1000) : 0;
+      timeout = timeout < 0 ? ms : std::min(timeout, ms);
+    }
+
+    pollfd fds[2] = {{m_inotifyFd, POLLIN, 0}, {m_wakeFd, POLLIN, 0}};
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+      LOG_ERROR(ROOT_LOGGER())
+          << "ConfigWatcher poll error: " << strerror(errno);
+      return;
+    }
+
+    ssize_t len;
+    while ((len = read(m_inotifyFd, buf, sizeof(buf))) > 0) {
+      uint64_t due = GetMonotonicUs() + m_debounceMs * 1000ull;
+      auto state = m_state.lock();
+      for (char* p = buf; p < buf + len;) {
+        auto event = (const inotify_event*)p;
+        p += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+          // events were lost, reload everything
+          for (const auto& [path, values] : state->files) {
+            pending[path] = due;
+          }
+          continue;
+        }
+        auto dir = state->dirs.find(event->wd);
+        if (dir == state->dirs.end() || event->len == 0) {
+          continue;
+        }
+        std::string path = JoinPath(dir->second, event->name);
+        if (state->files.count(path)) {
+          pending[path] = due;
+        }
+      }
+    }
+
+    now = GetMonotonicUs();
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (it->second <= now) {
+        reload(it->first);
+        it = pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+} // namespace cosmic
@@ -1,13 +1,64 @@
 #include "cosmic/log.h"
 
+#include "cosmic/compress.h"
+#include "cosmic/config.h"
+#include "cosmic/sync.h"
+#include "cosmic/thread.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <cstddef>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <functional>
 #include <ios>
 #include <iostream>
 #include <map>
+#include <netdb.h>
 #include <memory>
+#include <mutex>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <typeinfo>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace cosmic {
 
+LogLevel parseLogLevel(std::string_view name) {
+#define XX(level)                                                              \
+  if (name.size() == sizeof(#level) - 1 &&                                     \
+      strncasecmp(name.data(), #level, name.size()) == 0) {                    \
+    return LogLevel::level;                                                    \
+  }
+
+  XX(DEBUG);
+  XX(INFO);
+  XX(WARN);
+  XX(ERROR);
+  XX(FATAL);
+  XX(OFF);
+#undef XX
+  return LogLevel::UNKNOWN;
+}
+
 const char* stringifyLogLevel(LogLevel level) {
   switch (level) {
 #define XX(name)                                                               \
@@ -20,6 +71,7 @@ const char* stringifyLogLevel(LogLevel level) {
     XX(WARN);
     XX(ERROR);
     XX(FATAL);
+    XX(OFF);
   default:
     return "UNKNOWN";
 #undef XX
@@ -31,31 +83,38 @@ class MessageFormatItem : public LogFormatter::FormatItem {
 public:
   MessageFormatItem(const std::string& fmt = "") {}
   void format(std::ostream& os, const Logger& logger,
-              LogEvent::ptr event) override {
-    os << event->getContent();
+              const LogEvent& event) override {
+    os << event.getContent();
+    event.getMessage().forEachField(
+        [&os](LogFieldType, std::string_view key, std::string_view value) {
+          os << ' ' << key << '=' << value;
+        });
   }
 };
 
 class LevelFormatItem : public LogFormatter::FormatItem {
 public:
   LevelFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << stringifyLogLevel(event->getLevel());
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << stringifyLogLevel(event.getLevel());
   }
 };
 
 class UptimeFormatItem : public LogFormatter::FormatItem {
 public:
   UptimeFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << event->getUptime();
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << event.getUptime();
   }
 };
 
 class LoggerNameFormatItem : public LogFormatter::FormatItem {
 public:
   LoggerNameFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger& logger, LogEvent::ptr) override {
+  void format(std::ostream& os, const Logger& logger,
+              const LogEvent&) override {
     os << logger.getName();
   }
 };
@@ -63,26 +122,29 @@ public:
 class ThreadIdFormatItem : public LogFormatter::FormatItem {
 public:
   ThreadIdFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << event->getThreadId();
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << event.getThreadId();
   }
 };
 
 class FiberIdFormatItem : public LogFormatter::FormatItem {
 public:
   FiberIdFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << event->getFiberId();
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << event.getFiberId();
   }
 };
 
 class DateTimeFormatItem : public LogFormatter::FormatItem {
 public:
-  DateTimeFormatItem(const std::string& fmt = "%Y-%m-%d %H:%M:%S")
-      : m_format(fmt) {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
+  DateTimeFormatItem(const std::string& fmt = "")
+      : m_format(fmt.empty() ? "%Y-%m-%d %H:%M:%S" : fmt) {}
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
     struct tm tm;
-    time_t time = event->getTime();
+    time_t time = event.getTime();
     localtime_r(&time, &tm);
     char buf[64];
     strftime(buf, sizeof(buf), m_format.c_str(), &tm);
@@ -93,26 +155,52 @@ private:
   std::string m_format;
 };
 
+class MillisecondFormatItem : public LogFormatter::FormatItem {
+public:
+  MillisecondFormatItem(const std::string& fmt = "") {}
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%03u",
+             (uint32_t)(event.getTimeUs() / 1000 % 1000));
+    os << buf;
+  }
+};
+
+class MicrosecondFormatItem : public LogFormatter::FormatItem {
+public:
+  MicrosecondFormatItem(const std::string& fmt = "") {}
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "%06u",
+             (uint32_t)(event.getTimeUs() % 1000000));
+    os << buf;
+  }
+};
+
 class FilenameFormatItem : public LogFormatter::FormatItem {
 public:
   FilenameFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << event->getFile();
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << event.getFile();
   }
 };
 
 class LineFormatItem : public LogFormatter::FormatItem {
 public:
   LineFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr event) override {
-    os << event->getLine();
+  void format(std::ostream& os, const Logger&,
+              const LogEvent& event) override {
+    os << event.getLine();
   }
 };
 
 class NewLineFormatItem : public LogFormatter::FormatItem {
 public:
   NewLineFormatItem(const std::string& fmt = "") {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr) override {
+  void format(std::ostream& os, const Logger&, const LogEvent&) override {
     os << '\n';
   }
 };
@@ -120,7 +208,7 @@ public:
 class StringFormatItem : public LogFormatter::FormatItem {
 public:
   StringFormatItem(const std::string& str) : m_string(str) {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr) override {
+  void format(std::ostream& os, const Logger&, const LogEvent&) override {
     os << m_string;
   }
 
@@ -131,28 +219,227 @@ private:
 class TabFormatItem : public LogFormatter::FormatItem {
 public:
   TabFormatItem(const std::string& str) {}
-  void format(std::ostream& os, const Logger&, LogEvent::ptr) override {
+  void format(std::ostream& os, const Logger&, const LogEvent&) override {
     os << '\t';
   }
 };
 
+LogStream::LogStream(const LogStream& other) {
+  append(other.m_data, other.m_size);
+}
+
+LogStream::LogStream(LogStream&& other) noexcept { *this = std::move(other); }
+
+LogStream& LogStream::operator=(const LogStream& other) {
+  if (this != &other) {
+    m_size = 0;
+    append(other.m_data, other.m_size);
+  }
+  return *this;
+}
+
+LogStream& LogStream::operator=(LogStream&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  if (other.m_data == other.m_inline) {
+    // inline content is small, copying keeps our own heap buffer for reuse
+    m_size = 0;
+    append(other.m_data, other.m_size);
+    return *this;
+  }
+  release();
+  m_data = other.m_data;
+  m_size = other.m_size;
+  m_capacity = other.m_capacity;
+  other.m_data = other.m_inline;
+  other.m_size = 0;
+  other.m_capacity = kInlineSize;
+  return *this;
+}
+
+void LogStream::reset() {
+  if (m_capacity > kMaxRetainedSize) {
+    release();
+  }
+  m_size = 0;
+}
+
+void LogStream::grow(size_t need) {
+  size_t capacity = m_capacity * 2;
+  while (capacity < need) {
+    capacity *= 2;
+  }
+  char* data = new char[capacity];
+  std::memcpy(data, m_data, m_size);
+  if (m_data != m_inline) {
+    delete[] m_data;
+  }
+  m_data = data;
+  m_capacity = capacity;
+}
+
+void LogStream::release() {
+  if (m_data != m_inline) {
+    delete[] m_data;
+  }
+  m_data = m_inline;
+  m_size = 0;
+  m_capacity = kInlineSize;
+}
+
+LogStream& LogStream::operator<<(const void* ptr) {
+  if (!ptr) {
+    return *this << '0';
+  }
+  char buf[2 + 2 * sizeof(void*)] = {'0', 'x'};
+  auto res = std::to_chars(buf + 2, buf + sizeof(buf), (uintptr_t)ptr, 16);
+  append(buf, res.ptr - buf);
+  return *this;
+}
+
 LogEvent::LogEvent(LogLevel level, const char* file, int32_t line,
                    uint32_t uptime, int32_t threadId, uint32_t fiberId,
-                   int64_t time)
+                   uint64_t timeUs)
     : m_level(level), m_file(file), m_line(line), m_threadId(threadId),
-      m_fiberId(fiberId), m_time(time), m_uptime(uptime) {}
+      m_fiberId(fiberId), m_time(timeUs), m_uptime(uptime) {}
 
-LogEventTracker::LogEventTracker(LogEvent::ptr event, const Logger& logger)
-    : m_event(event), m_logger(logger) {}
+void LogEvent::reset(LogLevel level, const char* file, int32_t line,
+                     uint32_t uptime, int32_t threadId, uint32_t fiberId,
+                     uint64_t timeUs) {
+  m_level = level;
+  m_file = file;
+  m_line = line;
+  m_threadId = threadId;
+  m_fiberId = fiberId;
+  m_time = timeUs;
+  m_uptime = uptime;
+  m_stream.reset();
+}
+
+static thread_local LogEvent t_events[LogEventTracker::kMaxNesting];
+static thread_local int t_event_depth = 0;
+
+LogEventTracker::LogEventTracker(const Logger& logger, LogLevel level,
+                                 const char* file, int32_t line,
+                                 uint32_t uptime, int32_t threadId,
+                                 uint32_t fiberId, uint64_t timeUs)
+    : m_logger(logger) {
+  if (t_event_depth < kMaxNesting) {
+    m_event = &t_events[t_event_depth];
+  } else {
+    m_owned.reset(new LogEvent{});
+    m_event = m_owned.get();
+  }
+  ++t_event_depth;
+  m_event->reset(level, file, line, uptime, threadId, fiberId, timeUs);
+}
 
-LogEventTracker::~LogEventTracker() { m_logger.log(m_event); }
+LogEventTracker::~LogEventTracker() {
+  if (m_suppressed) {
+    m_event->getStream() << " (suppressed " << m_suppressed << " lines)";
+  }
+  m_logger.log(*m_event);
+  --t_event_depth;
+}
 
 LogFormatter::LogFormatter(const std::string& pattern) : m_pattern(pattern) {
   init();
 }
 
+// zero padded decimal, e.g. milliseconds of %s
+static void AppendPadded(LogStream& out, uint32_t value, int width) {
+  char buf[10];
+  for (int i = width - 1; i >= 0; --i) {
+    buf[i] = '0' + value % 10;
+    value /= 10;
+  }
+  out.append(buf, width);
+}
+
+/**
+ * @brief Last rendered %d per thread, a line only calls localtime_r and
+ * strftime when the second (or the formatter) changes.
+ */
+struct DateTimeCache {
+  uint64_t id = 0;
+  uint64_t second = 0;
+  size_t size = 0;
+  char buf[64];
+};
+
+static constexpr size_t kDateTimeCacheSize = 8; // power of two
+static thread_local DateTimeCache t_datetime_cache[kDateTimeCacheSize];
+static std::atomic<uint64_t> s_datetime_id{0};
+
+void LogFormatter::appendDateTime(LogStream& out, const Op& op,
+                                  uint64_t second) const {
+  DateTimeCache& cache = t_datetime_cache[op.id & (kDateTimeCacheSize - 1)];
+  if (cache.id != op.id || cache.second != second) {
+    struct tm tm;
+    time_t time = second;
+    localtime_r(&time, &tm);
+    cache.size = strftime(cache.buf, sizeof(cache.buf), op.text.c_str(), &tm);
+    cache.id = op.id;
+    cache.second = second;
+  }
+  out.append(cache.buf, cache.size);
+}
+
+uint64_t LogFormatter::NextDateTimeId() {
+  return s_datetime_id.fetch_add(1) + 1;
+}
+
+void LogFormatter::formatTo(LogStream& out, const Logger& logger,
+                            const LogEvent& event) const {
+  for (const auto& op : m_ops) {
+    switch (op.code) {
+    case OpCode::TEXT:
+      out << std::string_view{op.text};
+      break;
+    case OpCode::MESSAGE:
+      out << event.getContent();
+      event.getMessage().forEachField(
+          [&out](LogFieldType, std::string_view key, std::string_view value) {
+            out << ' ' << key << '=' << value;
+          });
+      break;
+    case OpCode::LEVEL:
+      out << stringifyLogLevel(event.getLevel());
+      break;
+    case OpCode::UPTIME:
+      out << event.getUptime();
+      break;
+    case OpCode::LOGGER_NAME:
+      out << logger.getName();
+      break;
+    case OpCode::THREAD_ID:
+      out << event.getThreadId();
+      break;
+    case OpCode::FIBER_ID:
+      out << event.getFiberId();
+      break;
+    case OpCode::DATETIME:
+      appendDateTime(out, op, event.getTime());
+      break;
+    case OpCode::FILENAME:
+      out << event.getFile();
+      break;
+    case OpCode::LINE:
+      out << event.getLine();
+      break;
+    case OpCode::MILLISECOND:
+      AppendPadded(out, event.getTimeUs() / 1000 % 1000, 3);
+      break;
+    case OpCode::MICROSECOND:
+      AppendPadded(out, event.getTimeUs() % 1000000, 6);
+      break;
+    }
+  }
+}
+
 std::string LogFormatter::format(const Logger& logger,
-                                 std::shared_ptr<LogEvent> event) {
+                                 const LogEvent& event) {
   std::ostringstream ss;
 
   for (const auto& item : m_items) {
@@ -169,6 +456,7 @@ void LogFormatter::setPattern(const std::string& pattern) {
 
 void LogFormatter::init() {
   m_items.clear();
+  m_ops.clear();
   // str, format, type
   // type: 0 = text, 1 = pattern
   std::vector<std::tuple<std::string, std::string, int>> vec;
@@ -248,6 +536,8 @@ void LogFormatter::init() {
    * %l: line number
    * %T: tab
    * %F: fiberId
+   * %s: millisecond of the second, 3 digits
+   * %u: microsecond of the second, 6 digits
    */
   static std::map<std::string, std::function<std::unique_ptr<FormatItem>(
                                    const std::string& str)>>
@@ -262,10 +552,20 @@ void LogFormatter::init() {
           XX(t, ThreadIdFormatItem), XX(n, NewLineFormatItem),
           XX(d, DateTimeFormatItem), XX(f, FilenameFormatItem),
           XX(l, LineFormatItem),     XX(T, TabFormatItem),
-          XX(F, FiberIdFormatItem)
+          XX(F, FiberIdFormatItem),  XX(s, MillisecondFormatItem),
+          XX(u, MicrosecondFormatItem)
 #undef XX
       };
 
+  static std::map<std::string, OpCode> s_ops_map = {
+      {"m", OpCode::MESSAGE},     {"p", OpCode::LEVEL},
+      {"r", OpCode::UPTIME},      {"c", OpCode::LOGGER_NAME},
+      {"t", OpCode::THREAD_ID},   {"d", OpCode::DATETIME},
+      {"f", OpCode::FILENAME},    {"l", OpCode::LINE},
+      {"F", OpCode::FIBER_ID},    {"s", OpCode::MILLISECOND},
+      {"u", OpCode::MICROSECOND},
+  };
+
   for (const auto& item : vec) {
     if (std::get<2>(item) == 0) {
       m_items.push_back(std::make_unique<StringFormatItem>(std::get<0>(item)));
@@ -279,18 +579,249 @@ void LogFormatter::init() {
       }
     }
   }
+
+  // compile: literals, tabs and new lines are merged into one TEXT op
+  auto appendText = [this](const std::string& text) {
+    if (m_ops.empty() || m_ops.back().code != OpCode::TEXT) {
+      m_ops.push_back(Op{OpCode::TEXT, ""});
+    }
+    m_ops.back().text += text;
+  };
+  for (const auto& item : vec) {
+    const std::string& str = std::get<0>(item);
+    if (std::get<2>(item) == 0) {
+      appendText(str);
+    } else if (str == "T") {
+      appendText("\t");
+    } else if (str == "n") {
+      appendText("\n");
+    } else {
+      auto it = s_ops_map.find(str);
+      if (it == s_ops_map.end()) {
+        appendText("<<error_format %" + str + ">>");
+      } else if (it->second == OpCode::DATETIME) {
+        std::string fmt = std::get<1>(item);
+        m_ops.push_back(Op{OpCode::DATETIME,
+                           fmt.empty() ? "%Y-%m-%d %H:%M:%S" : fmt,
+                           NextDateTimeId()});
+      } else {
+        m_ops.push_back(Op{it->second, ""});
+      }
+    }
+  }
+}
+
+// formatter output of the current thread, reused for every line
+static LogStream& GetFormatBuffer() {
+  static thread_local LogStream t_buffer;
+  t_buffer.reset();
+  return t_buffer;
+}
+
+JsonLogFormatter::JsonLogFormatter()
+    : LogFormatter(kPattern),
+      m_time{OpCode::DATETIME, "%Y-%m-%dT%H:%M:%S", NextDateTimeId()} {}
+
+std::string JsonLogFormatter::format(const Logger& logger,
+                                     const LogEvent& event) {
+  LogStream out;
+  formatTo(out, logger, event);
+  return out.str();
+}
+
+void JsonLogFormatter::formatTo(LogStream& out, const Logger& logger,
+                                const LogEvent& event) const {
+  out << "{\"time\":\"";
+  appendDateTime(out, m_time, event.getTime());
+  out << '.';
+  AppendPadded(out, event.getTimeUs() % 1000000, 6);
+  out << "\",\"level\":\"" << stringifyLogLevel(event.getLevel())
+      << "\",\"logger\":\"";
+  Escape(out, logger.getName());
+  out << "\",\"thread\":" << event.getThreadId()
+      << ",\"fiber\":" << event.getFiberId() << ",\"file\":\"";
+  Escape(out, event.getFile() ? event.getFile() : "");
+  out << "\",\"line\":" << event.getLine() << ",\"message\":\"";
+  Escape(out, event.getContent());
+  out << '"';
+  event.getMessage().forEachField(
+      [&out](LogFieldType type, std::string_view key, std::string_view value) {
+        out << ",\"";
+        Escape(out, key);
+        out << "\":";
+        if (type == LogFieldType::STRING) {
+          out << '"';
+          Escape(out, value);
+          out << '"';
+        } else {
+          out << value;
+        }
+      });
+  out << "}\n";
+}
+
+static void EscapeJsonByte(LogStream& out, unsigned char c) {
+  static const char kHex[] = "0123456789abcdef";
+  switch (c) {
+  case '"':
+    out.append("\\\"", 2);
+    break;
+  case '\\':
+    out.append("\\\\", 2);
+    break;
+  case '\n':
+    out.append("\\n", 2);
+    break;
+  case '\r':
+    out.append("\\r", 2);
+    break;
+  case '\t':
+    out.append("\\t", 2);
+    break;
+  case '\b':
+    out.append("\\b", 2);
+    break;
+  case '\f':
+    out.append("\\f", 2);
+    break;
+  default:
+    char buf[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+    out.append(buf, 6);
+  }
+}
+
+static void EscapeJsonScalar(LogStream& out, const char* p, const char* end) {
+  const char* run = p;
+  for (; p < end; ++p) {
+    unsigned char c = *p;
+    if (c < 0x20 || c == '"' || c == '\\') {
+      out.append(run, p - run);
+      EscapeJsonByte(out, c);
+      run = p + 1;
+    }
+  }
+  out.append(run, end - run);
+}
+
+#if defined(__SSE2__)
+// copy clean 16 byte blocks at once, stop before the tail
+static const char* EscapeJsonSse2(LogStream& out, const char* p,
+                                  const char* end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    // v <= 0x1F unsigned <=> min(v, 0x1F) == v
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+    unsigned mask = _mm_movemask_epi8(hit);
+    if (mask == 0) {
+      out.append(p, 16);
+      p += 16;
+      continue;
+    }
+    int i = __builtin_ctz(mask);
+    out.append(p, i);
+    EscapeJsonByte(out, p[i]);
+    p += i + 1;
+  }
+  return p;
+}
+
+__attribute__((target("avx2"))) static const char*
+EscapeJsonAvx2(LogStream& out, const char* p, const char* end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                        _mm256_cmpeq_epi8(v, backslash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+    unsigned mask = _mm256_movemask_epi8(hit);
+    if (mask == 0) {
+      out.append(p, 32);
+      p += 32;
+      continue;
+    }
+    int i = __builtin_ctz(mask);
+    out.append(p, i);
+    EscapeJsonByte(out, p[i]);
+    p += i + 1;
+  }
+  return p;
+}
+
+static bool HasAvx2() {
+  static const bool s_avx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return s_avx2;
 }
+#endif
 
-LogAppender::LogAppender(LogLevel level) : m_level(level) {
-  m_formatter = std::make_unique<LogFormatter>();
+void JsonLogFormatter::Escape(LogStream& out, std::string_view str) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+#if defined(__SSE2__)
+  p = HasAvx2() ? EscapeJsonAvx2(out, p, end) : EscapeJsonSse2(out, p, end);
+#endif
+  EscapeJsonScalar(out, p, end);
 }
 
+LogAppender::LogAppender(LogLevel level)
+    : m_formatter(std::make_shared<LogFormatter>()), m_level(level) {}
+
 LogAppender::LogAppender(std::unique_ptr<LogFormatter> formatter,
                          LogLevel level)
     : m_formatter(std::move(formatter)), m_level(level) {}
 
+void LogAppender::log(const Logger& logger, const LogEvent& event) {
+  if (event.getLevel() >= getLogLevel()) {
+    LogStream& buf = GetFormatBuffer();
+    getFormatter()->formatTo(buf, logger, event);
+    append(event, buf.view());
+  }
+}
+
+void LogAppender::setFormatter(std::unique_ptr<LogFormatter> formatter) {
+  m_formatter.store(std::shared_ptr<const LogFormatter>{std::move(formatter)},
+                    std::memory_order_release);
+  refreshOwners();
+}
+
 void LogAppender::setFormatter(const std::string& pattern) {
-  m_formatter->setPattern(pattern);
+  setFormatter(std::make_unique<LogFormatter>(pattern));
+}
+
+void LogAppender::setLogLevel(LogLevel level) {
+  m_level.store(level, std::memory_order_relaxed);
+  refreshOwners();
+}
+
+void LogAppender::refreshOwners() {
+  auto owners = m_owners.lock();
+  for (Logger* logger : *owners) {
+    logger->refresh();
+  }
+}
+
+void LogAppender::addOwner(Logger* logger) {
+  m_owners.lock()->push_back(logger);
+}
+
+void LogAppender::delOwner(Logger* logger) {
+  auto owners = m_owners.lock();
+  for (auto it = owners->begin(); it != owners->end(); ++it) {
+    if (*it == logger) {
+      owners->erase(it);
+      break;
+    }
+  }
 }
 
 StdoutLogAppender::StdoutLogAppender(std::unique_ptr<LogFormatter> formatter,
@@ -301,99 +832,2038 @@ StdoutLogAppender::StdoutLogAppender(LogLevel level) : LogAppender(level) {}
 
 StdoutLogAppender::StdoutLogAppender() : LogAppender(LogLevel::DEBUG) {}
 
-void StdoutLogAppender::log(const Logger& logger, LogEvent::ptr event) {
-  if (event->getLevel() >= m_level) {
-    std::cout << m_formatter->format(logger, event);
+void StdoutLogAppender::append(const LogEvent& event,
+                               std::string_view rendered) {
+  std::cout.write(rendered.data(), rendered.size());
+}
+
+FileLogOptions FileLogOptions::FromYaml(const YAML::Node& node) {
+  FileLogOptions options;
+  if (node["flush_bytes"]) {
+    options.flushBytes = node["flush_bytes"].as<size_t>();
+  }
+  if (node["flush_interval_ms"]) {
+    options.flushIntervalMs = node["flush_interval_ms"].as<uint32_t>();
+  }
+  if (node["flush_level"]) {
+    LogLevel level = parseLogLevel(node["flush_level"].as<std::string>());
+    if (level != LogLevel::UNKNOWN) {
+      options.flushLevel = level;
+    }
+  }
+  if (node["sync_interval_ms"]) {
+    options.syncIntervalMs = node["sync_interval_ms"].as<uint32_t>();
+  }
+  if (node["rotate_bytes"]) {
+    options.rotateBytes = node["rotate_bytes"].as<uint64_t>();
+  }
+  if (node["rotate_interval_s"]) {
+    options.rotateIntervalSec = node["rotate_interval_s"].as<uint32_t>();
+  }
+  if (node["max_files"]) {
+    options.maxFiles = node["max_files"].as<uint32_t>();
+  }
+  if (node["compress"]) {
+    options.compress = node["compress"].as<bool>();
+  }
+  return options;
+}
+
+void FileLogOptions::toYaml(YAML::Node& node) const {
+  const FileLogOptions defaults;
+  if (flushBytes != defaults.flushBytes) {
+    node["flush_bytes"] = flushBytes;
+  }
+  if (flushIntervalMs != defaults.flushIntervalMs) {
+    node["flush_interval_ms"] = flushIntervalMs;
+  }
+  if (flushLevel != defaults.flushLevel) {
+    node["flush_level"] = stringifyLogLevel(flushLevel);
+  }
+  if (syncIntervalMs != defaults.syncIntervalMs) {
+    node["sync_interval_ms"] = syncIntervalMs;
+  }
+  if (rotateBytes != defaults.rotateBytes) {
+    node["rotate_bytes"] = rotateBytes;
+  }
+  if (rotateIntervalSec != defaults.rotateIntervalSec) {
+    node["rotate_interval_s"] = rotateIntervalSec;
+  }
+  if (maxFiles != defaults.maxFiles) {
+    node["max_files"] = maxFiles;
+  }
+  if (compress != defaults.compress) {
+    node["compress"] = compress;
   }
 }
 
 FileLogAppender::FileLogAppender(const std::string& filename,
                                  std::unique_ptr<LogFormatter> formatter,
-                                 LogLevel level)
-    : LogAppender(std::move(formatter), level), m_filename(filename) {
-  reopen();
+                                 LogLevel level, const Options& options)
+    : LogAppender(std::move(formatter), level), m_filename(filename),
+      m_options(options) {
+  init();
 }
 
-FileLogAppender::FileLogAppender(const std::string& filename, LogLevel level)
-    : LogAppender(level), m_filename(filename) {
-  reopen();
+FileLogAppender::FileLogAppender(const std::string& filename, LogLevel level,
+                                 const Options& options)
+    : LogAppender(level), m_filename(filename), m_options(options) {
+  init();
 }
 
 FileLogAppender::FileLogAppender(const std::string& filename)
     : LogAppender(LogLevel::DEBUG), m_filename(filename) {
-  reopen();
+  init();
 }
 
 FileLogAppender::~FileLogAppender() {
-  if (m_filestream) {
-    m_filestream.close();
+  if (m_background) {
+    m_stopping.store(true, std::memory_order_release);
+    m_signal.notify();
+    m_background->join();
+  }
+  if (m_compressor) {
+    // rotate() is done, the compressor drains what is queued and exits
+    m_compressStopping.store(true, std::memory_order_release);
+    m_compressSignal.notify();
+    m_compressor->join();
+  }
+  flush();
+  auto fd = m_fd.lock();
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
   }
 }
 
-void FileLogAppender::log(const Logger& logger, LogEvent::ptr event) {
-  if (!m_filestream.is_open()) {
-    reopen();
+void FileLogAppender::init() {
+  reopen();
+  if (m_options.flushIntervalMs > 0 || m_options.rotateBytes > 0 ||
+      m_options.rotateIntervalSec > 0) {
+    m_background.reset(
+        new Thread{[this]() { runBackground(); }, "log_file"});
   }
-  if (event->getLevel() >= m_level) {
-    m_filestream << m_formatter->format(logger, event);
-    m_filestream.flush();
+  if (m_options.compress && m_background) {
+    m_compressor.reset(
+        new Thread{[this]() { runCompress(); }, "log_gzip"});
   }
 }
 
-bool FileLogAppender::reopen() {
-  if (m_filestream) {
-    m_filestream.close();
+void FileLogAppender::runBackground() {
+  uint32_t interval =
+      m_options.flushIntervalMs > 0 ? m_options.flushIntervalMs : 1000;
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    m_signal.waitFor(interval);
+    if (m_options.flushIntervalMs > 0) {
+      flush();
+    }
+    if (needRotate()) {
+      rotate();
+    }
   }
-  m_filestream.open(m_filename, std::ios_base::out | std::ios_base::app);
-  return !!m_filestream;
 }
 
-Logger::Logger(const std::string& name) : m_name(name) {}
+void FileLogAppender::append(const LogEvent& event,
+                             std::string_view rendered) {
+  bool full;
+  {
+    auto pending = m_pending.lock();
+    if (pending->chunks.empty() ||
+        pending->chunks.back().size() + rendered.size() > kChunkSize) {
+      if (pending->spare.empty()) {
+        pending->chunks.emplace_back();
+        pending->chunks.back().reserve(kChunkSize);
+      } else {
+        pending->chunks.push_back(std::move(pending->spare.back()));
+        pending->spare.pop_back();
+      }
+    }
+    pending->chunks.back().append(rendered);
+    pending->bytes += rendered.size();
+    full = pending->bytes >= m_options.flushBytes;
+  }
+  if (full || event.getLevel() >= m_options.flushLevel) {
+    flush();
+  }
+}
 
-void Logger::log(LogEvent::ptr event) const {
-  for (const auto& appender : m_appenders) {
-    appender->log(*this, event);
+// write every iovec, writev may stop early on signals or partial writes
+static bool WriteAll(int fd, std::vector<struct iovec>& iov) {
+  size_t index = 0;
+  while (index < iov.size()) {
+    int count = (int)std::min<size_t>(iov.size() - index, IOV_MAX);
+    ssize_t n = writev(fd, &iov[index], count);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    while (index < iov.size() && (size_t)n >= iov[index].iov_len) {
+      n -= iov[index].iov_len;
+      ++index;
+    }
+    if (n > 0) {
+      iov[index].iov_base = (char*)iov[index].iov_base + n;
+      iov[index].iov_len -= n;
+    }
   }
+  return true;
 }
 
-void Logger::addAppender(std::shared_ptr<LogAppender> appender) {
-  m_appenders.push_back(appender);
+static int OpenLogFile(const std::string& filename, uint64_t* size) {
+  int fd =
+      open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  struct stat st;
+  if (fd >= 0 && size) {
+    *size = fstat(fd, &st) == 0 ? st.st_size : 0;
+  }
+  return fd;
 }
 
-void Logger::delAppender(std::shared_ptr<LogAppender> appender) {
-  for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
-    if (*it == appender) {
-      m_appenders.erase(it);
+void FileLogAppender::flush() {
+  auto fd = m_fd.lock();
+  std::vector<std::string> chunks;
+  {
+    auto pending = m_pending.lock();
+    chunks.swap(pending->chunks);
+    pending->bytes = 0;
+  }
+  if (chunks.empty()) {
+    return;
+  }
+
+  if (*fd < 0) {
+    *fd = OpenLogFile(m_filename, &m_fileBytes);
+  }
+  if (*fd >= 0) {
+    std::vector<struct iovec> iov;
+    iov.reserve(chunks.size());
+    for (auto& chunk : chunks) {
+      iov.push_back({chunk.data(), chunk.size()});
+      m_fileBytes += chunk.size();
+    }
+    WriteAll(*fd, iov);
+
+    if (m_options.syncIntervalMs > 0) {
+      uint64_t now = GetMonotonicUs();
+      if (now - m_lastSyncUs >= m_options.syncIntervalMs * 1000ull) {
+        fdatasync(*fd);
+        m_lastSyncUs = now;
+      }
+    }
+
+    if (m_options.rotateBytes > 0 && m_fileBytes >= m_options.rotateBytes &&
+        !m_rotateRequested.exchange(true)) {
+      m_signal.notify();
+    }
+  }
+
+  auto pending = m_pending.lock();
+  for (auto& chunk : chunks) {
+    if (pending->spare.size() >= 4) {
       break;
     }
+    chunk.clear();
+    pending->spare.push_back(std::move(chunk));
   }
 }
 
-std::shared_ptr<LoggerManager> LoggerManager::s_instance = nullptr;
+bool FileLogAppender::reopen() {
+  auto fd = m_fd.lock();
+  if (*fd >= 0) {
+    close(*fd);
+  }
+  *fd = OpenLogFile(m_filename, &m_fileBytes);
+  m_openedUs.store(GetMonotonicUs(), std::memory_order_relaxed);
+  return *fd >= 0;
+}
 
-std::shared_ptr<LoggerManager> LoggerManager::GetInstance() {
-  if (s_instance == nullptr) {
-    s_instance = std::shared_ptr<LoggerManager>{new LoggerManager{}};
+bool FileLogAppender::needRotate() {
+  if (m_rotateRequested.exchange(false)) {
+    return true;
   }
-  return s_instance;
+  if (m_options.rotateIntervalSec == 0) {
+    return false;
+  }
+  uint64_t opened = m_openedUs.load(std::memory_order_relaxed);
+  return GetMonotonicUs() - opened >= m_options.rotateIntervalSec * 1000000ull;
 }
 
-LoggerManager::LoggerManager() {
-  m_root.reset(new Logger{});
-  m_root->addAppender(std::shared_ptr<LogAppender>{new StdoutLogAppender{}});
-  m_loggers[m_root->getName()] = m_root;
+void FileLogAppender::rotate() {
+  {
+    auto fd = m_fd.lock();
+    if (m_fileBytes == 0) {
+      // nothing to retire, restart the interval
+      m_openedUs.store(GetMonotonicUs(), std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  char stamp[32];
+  struct tm tm;
+  time_t now = time(nullptr);
+  localtime_r(&now, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+  std::string rotated = m_filename + "." + stamp;
+  for (int i = 1; access(rotated.c_str(), F_OK) == 0 ||
+                  access((rotated + ".gz").c_str(), F_OK) == 0;
+       ++i) {
+    rotated = m_filename + "." + stamp + "-" + std::to_string(i);
+  }
+
+  // writers keep using the old fd, which now points at the rotated file
+  if (rename(m_filename.c_str(), rotated.c_str()) != 0) {
+    return;
+  }
+  uint64_t size = 0;
+  int newFd = OpenLogFile(m_filename, &size);
+  if (newFd < 0) {
+    return;
+  }
+  int oldFd;
+  {
+    auto fd = m_fd.lock();
+    oldFd = *fd;
+    *fd = newFd;
+    m_fileBytes = size;
+  }
+  m_openedUs.store(GetMonotonicUs(), std::memory_order_relaxed);
+  if (oldFd >= 0) {
+    close(oldFd);
+  }
+
+  if (m_compressor) {
+    // the compressor prunes once the .gz exists
+    m_compressQueue.lock()->push_back(std::move(rotated));
+    m_compressSignal.notify();
+  } else if (m_options.maxFiles > 0) {
+    pruneRotated();
+  }
+}
+
+void FileLogAppender::runCompress() {
+  for (;;) {
+    m_compressSignal.wait();
+    for (;;) {
+      std::string rotated;
+      {
+        auto queue = m_compressQueue.lock();
+        if (queue->empty()) {
+          break;
+        }
+        rotated = std::move(queue->front());
+        queue->pop_front();
+      }
+      if (GzipFile(rotated, rotated + ".gz")) {
+        unlink(rotated.c_str());
+      }
+      if (m_options.maxFiles > 0) {
+        pruneRotated();
+      }
+    }
+    if (m_compressStopping.load(std::memory_order_acquire)) {
+      break;
+    }
+  }
+}
+
+void FileLogAppender::pruneRotated() {
+  size_t slash = m_filename.find_last_of('/');
+  std::string dir =
+      slash == std::string::npos ? "." : m_filename.substr(0, slash + 1);
+  std::string prefix = (slash == std::string::npos
+                            ? m_filename
+                            : m_filename.substr(slash + 1)) +
+                       ".";
+
+  // rotated names carry a sortable timestamp
+  std::vector<std::string> rotated;
+  DIR* handle = opendir(dir.c_str());
+  if (!handle) {
+    return;
+  }
+  while (struct dirent* entry = readdir(handle)) {
+    std::string_view name = entry->d_name;
+    if (name.size() > prefix.size() + 8 &&
+        name.compare(0, prefix.size(), prefix) == 0 &&
+        std::isdigit((unsigned char)name[prefix.size()])) {
+      rotated.emplace_back(name);
+    }
+  }
+  closedir(handle);
+
+  if (rotated.size() <= m_options.maxFiles) {
+    return;
+  }
+  std::sort(rotated.begin(), rotated.end());
+  size_t excess = rotated.size() - m_options.maxFiles;
+  for (size_t i = 0; i < excess; ++i) {
+    std::string path = slash == std::string::npos
+                           ? rotated[i]
+                           : m_filename.substr(0, slash + 1) + rotated[i];
+    unlink(path.c_str());
+  }
+}
+
+MmapFileLogAppender::MmapFileLogAppender(
+    const std::string& basename, std::unique_ptr<LogFormatter> formatter,
+    LogLevel level, size_t segmentSize)
+    : LogAppender(std::move(formatter), level), m_basename(basename),
+      m_segmentSize(segmentSize) {
+  init();
+}
+
+MmapFileLogAppender::MmapFileLogAppender(const std::string& basename,
+                                         LogLevel level, size_t segmentSize)
+    : LogAppender(level), m_basename(basename), m_segmentSize(segmentSize) {
+  init();
+}
+
+MmapFileLogAppender::MmapFileLogAppender(const std::string& basename)
+    : LogAppender(LogLevel::DEBUG), m_basename(basename),
+      m_segmentSize(kDefaultSegmentSize) {
+  init();
 }
 
-std::shared_ptr<Logger> LoggerManager::getLogger(const std::string& name) {
-  auto it = m_loggers.find(name);
-  if (it != m_loggers.end()) {
-    return it->second;
+MmapFileLogAppender::~MmapFileLogAppender() {
+  m_stopping.store(true, std::memory_order_release);
+  m_signal.notify();
+  m_preparer->join();
+
+  // no writer is left, m_segments frees the structs
+  std::vector<Segment*> retired;
+  retired.swap(*m_retired.lock());
+  for (Segment* segment : retired) {
+    releaseSegment(segment, segment->end.load(std::memory_order_acquire));
+  }
+
+  Segment* current = m_current.load(std::memory_order_acquire);
+  if (current != &m_dropping) {
+    releaseSegment(current,
+                   std::min(current->offset.load(), current->size));
   }
 
-  // add new logger
-  std::shared_ptr<Logger> logger{new Logger{name}};
-  m_loggers[name] = logger;
-  return logger;
+  // the prepared segment was never written
+  Segment* next = m_next.exchange(nullptr);
+  if (next) {
+    releaseSegment(next, 0);
+    unlink(next->path.c_str());
+  }
+}
+
+void MmapFileLogAppender::init() {
+  m_current.store(createSegment(), std::memory_order_release);
+  m_preparer.reset(new Thread{[this]() { runPreparer(); }, "log_mmap"});
 }
 
+MmapFileLogAppender::Segment* MmapFileLogAppender::createSegment() {
+  std::unique_ptr<Segment> segment{new Segment{}};
+  segment->size = m_segmentSize;
+
+  // never reuse a segment left by an earlier run
+  for (;;) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06lu",
+             (unsigned long)m_sequence.fetch_add(1));
+    segment->path = m_basename + suffix;
+    segment->fd = open(segment->path.c_str(),
+                       O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (segment->fd >= 0) {
+      break;
+    }
+    if (errno != EEXIST) {
+      throw std::runtime_error("MmapFileLogAppender open error: " +
+                               segment->path);
+    }
+  }
+
+  // reserve the blocks up front, fall back to a sparse file
+  if (fallocate(segment->fd, 0, 0, segment->size) != 0 &&
+      ftruncate(segment->fd, segment->size) != 0) {
+    close(segment->fd);
+    throw std::runtime_error("MmapFileLogAppender fallocate error: " +
+                             segment->path);
+  }
+
+  void* base = mmap(nullptr, segment->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, segment->fd, 0);
+  if (base == MAP_FAILED) {
+    close(segment->fd);
+    throw std::runtime_error("MmapFileLogAppender mmap error: " +
+                             segment->path);
+  }
+  segment->base = (char*)base;
+
+  Segment* raw = segment.get();
+  m_segments.lock()->push_back(std::move(segment));
+  return raw;
+}
+
+MmapFileLogAppender::Segment* MmapFileLogAppender::tryCreateSegment() {
+  try {
+    Segment* segment = createSegment();
+    uint64_t failures = m_createFailures.exchange(0);
+    if (failures > 0) {
+      std::cerr << "MmapFileLogAppender segment created after " << failures
+                << " failed attempts" << std::endl;
+    }
+    return segment;
+  } catch (std::exception& e) {
+    // the preparer retries every 100ms, report the first failure only
+    if (m_createFailures.fetch_add(1) == 0) {
+      std::cerr << e.what() << std::endl;
+    }
+    return nullptr;
+  }
+}
+
+void MmapFileLogAppender::append(const LogEvent& event,
+                                 std::string_view rendered) {
+  size_t len = std::min(rendered.size(), m_segmentSize);
+  Rcu::ReadGuard guard;
+  for (;;) {
+    Segment* segment = m_current.load(std::memory_order_acquire);
+    if (segment == &m_dropping) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    size_t offset = segment->offset.fetch_add(len, std::memory_order_relaxed);
+    if (offset + len <= segment->size) {
+      std::memcpy(segment->base + offset, rendered.data(), len);
+      segment->committed.fetch_add(len, std::memory_order_release);
+      return;
+    }
+
+    if (offset <= segment->size) {
+      // the first reservation past the end switches segment
+      roll(segment, offset);
+    } else {
+      while (m_current.load(std::memory_order_acquire) == segment) {
+        sched_yield();
+      }
+    }
+  }
+}
+
+void MmapFileLogAppender::roll(Segment* full, size_t end) {
+  full->end.store(end, std::memory_order_release);
+
+  Segment* next = m_next.exchange(nullptr, std::memory_order_acq_rel);
+  if (!next) {
+    // the preparer fell behind, pay for the syscalls here
+    next = tryCreateSegment();
+  }
+  if (!next) {
+    // writers waiting on this roll must leave, drop lines until the
+    // preparer creates a segment
+    next = &m_dropping;
+  }
+  m_current.store(next, std::memory_order_release);
+
+  m_retired.lock()->push_back(full);
+  m_signal.notify();
+}
+
+void MmapFileLogAppender::releaseSegment(Segment* segment, size_t end) {
+  while (segment->committed.load(std::memory_order_acquire) < end) {
+    sched_yield();
+  }
+  munmap(segment->base, segment->size);
+  segment->base = nullptr;
+  if (ftruncate(segment->fd, end) != 0) {
+    // keep the preallocated tail, readers stop at the first NUL
+  }
+  close(segment->fd);
+  segment->fd = -1;
+}
+
+void MmapFileLogAppender::closeSegment(Segment* segment, size_t end) {
+  // a writer or flush() may have loaded it just before the roll, keep it
+  // mapped until they are gone
+  Rcu::Synchronize();
+  releaseSegment(segment, end);
+  auto segments = m_segments.lock();
+  std::erase_if(*segments, [segment](const std::unique_ptr<Segment>& s) {
+    return s.get() == segment;
+  });
+}
+
+void MmapFileLogAppender::runPreparer() {
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    if (m_current.load(std::memory_order_acquire) == &m_dropping) {
+      // only this thread replaces the sentinel, writers never roll it
+      Segment* next = m_next.exchange(nullptr, std::memory_order_acq_rel);
+      if (!next) {
+        next = tryCreateSegment();
+      }
+      if (next) {
+        m_current.store(next, std::memory_order_release);
+      }
+    }
+    if (!m_next.load(std::memory_order_acquire)) {
+      // writers create the segment themselves on rollover
+      m_next.store(tryCreateSegment(), std::memory_order_release);
+    }
+
+    std::vector<Segment*> retired;
+    retired.swap(*m_retired.lock());
+    for (Segment* segment : retired) {
+      closeSegment(segment, segment->end.load(std::memory_order_acquire));
+    }
+
+    m_signal.waitFor(100);
+  }
+}
+
+void MmapFileLogAppender::flush() {
+  Rcu::ReadGuard guard;
+  Segment* segment = m_current.load(std::memory_order_acquire);
+  if (segment == &m_dropping) {
+    return;
+  }
+  // writers copy out of order, sync every reserved byte
+  size_t reserved = segment->offset.load(std::memory_order_relaxed);
+  msync(segment->base, std::min(reserved, segment->size), MS_ASYNC);
+}
+
+SocketLogOptions SocketLogOptions::FromYaml(const YAML::Node& node) {
+  SocketLogOptions options;
+  if (node["batch_lines"]) {
+    options.batchLines = std::max<size_t>(node["batch_lines"].as<size_t>(), 1);
+  }
+  if (node["flush_interval_ms"]) {
+    options.flushIntervalMs = node["flush_interval_ms"].as<uint32_t>();
+  }
+  if (node["max_pending_lines"]) {
+    options.maxPendingLines = node["max_pending_lines"].as<size_t>();
+  }
+  if (node["reconnect_interval_ms"]) {
+    options.reconnectIntervalMs = node["reconnect_interval_ms"].as<uint32_t>();
+  }
+  return options;
+}
+
+void SocketLogOptions::toYaml(YAML::Node& node) const {
+  const SocketLogOptions defaults;
+  if (batchLines != defaults.batchLines) {
+    node["batch_lines"] = batchLines;
+  }
+  if (flushIntervalMs != defaults.flushIntervalMs) {
+    node["flush_interval_ms"] = flushIntervalMs;
+  }
+  if (maxPendingLines != defaults.maxPendingLines) {
+    node["max_pending_lines"] = maxPendingLines;
+  }
+  if (reconnectIntervalMs != defaults.reconnectIntervalMs) {
+    node["reconnect_interval_ms"] = reconnectIntervalMs;
+  }
+}
+
+// "unix:/path", "unix:@abstract" or "udp:host:port", -1 on failure
+static int ConnectLogSocket(const std::string& address) {
+  std::string_view view = address;
+  if (view.starts_with("unix:")) {
+    std::string_view path = view.substr(5);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      return -1;
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+      addr.sun_path[0] = '\0';
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    socklen_t len = offsetof(struct sockaddr_un, sun_path) + path.size() +
+                    (path[0] == '@' ? 0 : 1);
+    if (::connect(fd, (struct sockaddr*)&addr, len) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  if (view.starts_with("udp:")) {
+    std::string_view hostPort = view.substr(4);
+    size_t colon = hostPort.rfind(':');
+    if (colon == std::string_view::npos) {
+      return -1;
+    }
+    std::string host{hostPort.substr(0, colon)};
+    std::string port{hostPort.substr(colon + 1)};
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+      host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+      return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai; ai = ai->ai_next) {
+      fd = socket(ai->ai_family,
+                  ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  ai->ai_protocol);
+      if (fd < 0) {
+        continue;
+      }
+      if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+  }
+  return -1;
+}
+
+SocketLogAppender::SocketLogAppender(const std::string& address,
+                                     std::unique_ptr<LogFormatter> formatter,
+                                     LogLevel level, const Options& options)
+    : LogAppender(std::move(formatter), level), m_address(address),
+      m_options(options) {
+  if (!address.starts_with("unix:") && !address.starts_with("udp:")) {
+    throw std::invalid_argument("SocketLogAppender bad address: " + address);
+  }
+  connect(*m_conn.lock());
+  m_background.reset(
+      new Thread{[this]() { runBackground(); }, "log_socket"});
+}
+
+SocketLogAppender::SocketLogAppender(const std::string& address,
+                                     LogLevel level, const Options& options)
+    : SocketLogAppender(address, std::make_unique<LogFormatter>(), level,
+                        options) {}
+
+SocketLogAppender::~SocketLogAppender() {
+  m_stopping.store(true, std::memory_order_release);
+  m_signal.notify();
+  m_background->join();
+  flush();
+  disconnect(*m_conn.lock());
+}
+
+void SocketLogAppender::connect(Connection& conn) {
+  conn.fd = ConnectLogSocket(m_address);
+  conn.retryUs = GetMonotonicUs() + m_options.reconnectIntervalMs * 1000ull;
+  m_connected.store(conn.fd >= 0, std::memory_order_relaxed);
+}
+
+void SocketLogAppender::disconnect(Connection& conn) {
+  if (conn.fd >= 0) {
+    close(conn.fd);
+    conn.fd = -1;
+  }
+  m_connected.store(false, std::memory_order_relaxed);
+}
+
+void SocketLogAppender::append(const LogEvent& event,
+                               std::string_view rendered) {
+  bool wake;
+  {
+    auto pending = m_pending.lock();
+    if (pending->lines.size() >= m_options.maxPendingLines) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    pending->lines.emplace_back(pending->data.size(), rendered.size());
+    pending->data.append(rendered);
+    // one wakeup per batch, the sender takes everything pending
+    wake = pending->lines.size() == m_options.batchLines;
+  }
+  if (wake) {
+    m_signal.notify();
+  }
+}
+
+void SocketLogAppender::flush() {
+  auto conn = m_conn.lock();
+  Batch& sending = conn->sending;
+  if (sending.next == sending.lines.size()) {
+    sending.data.clear();
+    sending.lines.clear();
+    sending.next = 0;
+    std::swap(sending, *m_pending.lock());
+  }
+  if (conn->fd < 0) {
+    return; // kept until the background thread reconnects
+  }
+
+  constexpr size_t kMaxBatch = 1024; // UIO_MAXIOV
+  size_t batch = std::min(m_options.batchLines, kMaxBatch);
+  std::vector<struct mmsghdr> msgs(batch);
+  std::vector<struct iovec> iovs(batch);
+  while (sending.next < sending.lines.size()) {
+    size_t count = std::min(batch, sending.lines.size() - sending.next);
+    for (size_t i = 0; i < count; ++i) {
+      auto [offset, length] = sending.lines[sending.next + i];
+      iovs[i].iov_base = sending.data.data() + offset;
+      iovs[i].iov_len = length;
+      std::memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = sendmmsg(conn->fd, msgs.data(), count, MSG_DONTWAIT);
+    if (n > 0) {
+      sending.next += n;
+      m_sent.fetch_add(n, std::memory_order_relaxed);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == ENOBUFS)) {
+      return; // the peer is behind, retry on the next flush
+    }
+    if (n < 0 && errno == EMSGSIZE) {
+      ++sending.next; // can never be sent
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    // the peer went away, reconnect on the background thread
+    disconnect(*conn);
+    return;
+  }
+}
+
+void SocketLogAppender::runBackground() {
+  uint32_t interval =
+      m_options.flushIntervalMs > 0 ? m_options.flushIntervalMs : 50;
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    m_signal.waitFor(interval);
+    {
+      auto conn = m_conn.lock();
+      if (conn->fd < 0 && GetMonotonicUs() >= conn->retryUs) {
+        connect(*conn);
+      }
+    }
+    flush();
+  }
+}
+
+// unknown names give DROP_NEWEST, the default
+LogOverflow parseLogOverflow(std::string_view name) {
+  auto is = [name](std::string_view expected) {
+    return name.size() == expected.size() &&
+           strncasecmp(name.data(), expected.data(), name.size()) == 0;
+  };
+  if (is("block")) {
+    return LogOverflow::BLOCK;
+  }
+  if (is("drop_oldest")) {
+    return LogOverflow::DROP_OLDEST;
+  }
+  if (is("drop_below_level")) {
+    return LogOverflow::DROP_BELOW_LEVEL;
+  }
+  return LogOverflow::DROP_NEWEST;
+}
+
+const char* stringifyLogOverflow(LogOverflow overflow) {
+  switch (overflow) {
+  case LogOverflow::BLOCK:
+    return "block";
+  case LogOverflow::DROP_NEWEST:
+    return "drop_newest";
+  case LogOverflow::DROP_OLDEST:
+    return "drop_oldest";
+  case LogOverflow::DROP_BELOW_LEVEL:
+    return "drop_below_level";
+  }
+  return "drop_newest";
+}
+
+AsyncLogOptions AsyncLogOptions::FromYaml(const YAML::Node& node) {
+  AsyncLogOptions options;
+  if (node["queue_depth"]) {
+    options.queueDepth = node["queue_depth"].as<size_t>();
+  }
+  if (node["overflow"]) {
+    options.overflow = parseLogOverflow(node["overflow"].as<std::string>());
+  }
+  if (node["drop_level"]) {
+    LogLevel level = parseLogLevel(node["drop_level"].as<std::string>());
+    if (level != LogLevel::UNKNOWN) {
+      options.dropLevel = level;
+    }
+  }
+  return options;
+}
+
+void AsyncLogOptions::toYaml(YAML::Node& node) const {
+  const AsyncLogOptions defaults;
+  if (queueDepth != defaults.queueDepth) {
+    node["queue_depth"] = queueDepth;
+  }
+  if (overflow != defaults.overflow) {
+    node["overflow"] = stringifyLogOverflow(overflow);
+  }
+  if (dropLevel != defaults.dropLevel) {
+    node["drop_level"] = stringifyLogLevel(dropLevel);
+  }
+}
+
+/**
+ * @brief Consumer loop of a queue whose producers count every accepted
+ * item in queued, then post one token to signal.
+ *
+ * A token does not mean the head slot is readable: a producer may publish
+ * and post while a slot claimed earlier by another one is still being
+ * written, and tryPop() fails on it. So a wakeup drains all it can and
+ * keeps polling while done() lags queued; the token of the slow producer
+ * then only causes a spare wakeup. Returns once stopping is set and every
+ * queued item is done.
+ */
+template <class T, class Done, class Fn>
+static void DrainLogQueue(MpmcQueue<T>& queue, Semaphore& signal,
+                          const std::atomic<uint64_t>& queued,
+                          const std::atomic<bool>& stopping, Done done,
+                          Fn fn) {
+  T item;
+  for (;;) {
+    signal.wait();
+    for (;;) {
+      while (queue.tryPop(item)) {
+        fn(item);
+      }
+      if (done() >= queued.load(std::memory_order_acquire)) {
+        break;
+      }
+      sched_yield(); // a claimed slot is not published yet
+    }
+    if (stopping.load(std::memory_order_acquire)) {
+      break;
+    }
+  }
+}
+
+AsyncLogAppender::Line&
+AsyncLogAppender::Line::operator=(Line&& other) noexcept {
+  event = other.event;
+  text.swap(other.text);
+  queuedUs = other.queuedUs;
+  return *this;
+}
+
+AsyncLogAppender::Line& AsyncLogAppender::Line::operator=(
+    std::pair<const LogEvent*, std::string_view> src) {
+  const LogEvent& e = *src.first;
+  event.reset(e.getLevel(), e.getFile(), e.getLine(), e.getUptime(),
+              e.getThreadId(), e.getFiberId(), e.getTimeUs());
+  text.assign(src.second);
+  queuedUs = GetMonotonicUs();
+  return *this;
+}
+
+AsyncLogAppender::AsyncLogAppender(std::shared_ptr<LogAppender> appender,
+                                   const Options& options)
+    : LogAppender(appender->getLogLevel()), m_appender(std::move(appender)),
+      m_options(options), m_queue(options.queueDepth) {
+  m_formatter.store(m_appender->getFormatter(), std::memory_order_release);
+  m_thread.reset(new Thread{[this]() { run(); }, "log_appender"});
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+  m_stopping.store(true, std::memory_order_release);
+  m_signal.notify();
+  m_thread->join();
+  m_appender->flush();
+}
+
+bool AsyncLogAppender::push(const LogEvent& event,
+                            std::string_view rendered) {
+  if (!m_queue.tryPush(std::make_pair(&event, rendered))) {
+    return false;
+  }
+  m_queued.fetch_add(1, std::memory_order_release);
+  m_signal.notify();
+  return true;
+}
+
+void AsyncLogAppender::pushBlocking(const LogEvent& event,
+                                    std::string_view rendered) {
+  m_blocked.fetch_add(1, std::memory_order_relaxed);
+  m_waiters.fetch_add(1, std::memory_order_seq_cst);
+  while (!push(event, rendered)) {
+    // the timeout covers a wakeup taken by another producer
+    m_space.waitFor(1);
+  }
+  m_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void AsyncLogAppender::append(const LogEvent& event,
+                              std::string_view rendered) {
+  if (m_options.overflow == LogOverflow::DROP_BELOW_LEVEL &&
+      event.getLevel() < m_options.dropLevel &&
+      m_queue.size() >= m_queue.capacity() / 4 * 3) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (push(event, rendered)) {
+    return;
+  }
+
+  switch (m_options.overflow) {
+  case LogOverflow::DROP_NEWEST:
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    break;
+  case LogOverflow::DROP_OLDEST: {
+    Line evicted;
+    do {
+      if (m_queue.tryPop(evicted)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_evicted.fetch_add(1, std::memory_order_release);
+      }
+    } while (!push(event, rendered));
+    break;
+  }
+  case LogOverflow::BLOCK:
+  case LogOverflow::DROP_BELOW_LEVEL:
+    pushBlocking(event, rendered);
+    break;
+  }
+}
+
+void AsyncLogAppender::run() {
+  auto done = [this]() {
+    return m_written.load(std::memory_order_acquire) +
+           m_evicted.load(std::memory_order_acquire);
+  };
+  DrainLogQueue(m_queue, m_signal, m_queued, m_stopping, done,
+                [this](Line& line) {
+                  if (m_waiters.load(std::memory_order_seq_cst) > 0) {
+                    m_space.notify();
+                  }
+                  uint64_t latency = GetMonotonicUs() - line.queuedUs;
+                  m_appender->append(line.event, line.text);
+
+                  m_latencySumUs.fetch_add(latency,
+                                           std::memory_order_relaxed);
+                  uint64_t max =
+                      m_latencyMaxUs.load(std::memory_order_relaxed);
+                  while (latency > max &&
+                         !m_latencyMaxUs.compare_exchange_weak(
+                             max, latency, std::memory_order_relaxed)) {
+                  }
+                  m_written.fetch_add(1, std::memory_order_release);
+                });
+}
+
+void AsyncLogAppender::flush() {
+  uint64_t target = m_queued.load(std::memory_order_acquire);
+  while (m_written.load(std::memory_order_acquire) +
+             m_evicted.load(std::memory_order_acquire) <
+         target) {
+    sched_yield();
+  }
+  m_appender->flush();
+}
+
+AsyncLogStats AsyncLogAppender::getStats() const {
+  AsyncLogStats stats;
+  stats.depth = m_queue.size();
+  stats.capacity = m_queue.capacity();
+  stats.queued = m_queued.load(std::memory_order_relaxed);
+  stats.dropped = m_dropped.load(std::memory_order_relaxed);
+  stats.written = m_written.load(std::memory_order_relaxed);
+  stats.blocked = m_blocked.load(std::memory_order_relaxed);
+  stats.maxLatencyUs = m_latencyMaxUs.load(std::memory_order_relaxed);
+  if (stats.written > 0) {
+    stats.avgLatencyUs =
+        m_latencySumUs.load(std::memory_order_relaxed) / stats.written;
+  }
+  return stats;
+}
+
+/**
+ * @brief One recorded line. seq is 0 while empty, odd while the owner
+ * writes it, 2 * (index + 1) once complete. The payload is copied word by
+ * word with relaxed atomics so a concurrent dump is a seqlock read.
+ */
+struct FlightRecorderLogAppender::Slot {
+  static constexpr size_t kWords = kSlotSize / sizeof(uint64_t);
+
+  std::atomic<uint64_t> seq{0};
+  std::atomic<uint64_t> timeUs{0};
+  std::atomic<uint32_t> len{0};
+  std::atomic<uint64_t> words[kWords];
+};
+
+/**
+ * @brief Ring of one thread, reused by another thread after its owner
+ * exits.
+ */
+struct FlightRecorderLogAppender::Ring {
+  explicit Ring(size_t capacity)
+      : mask(capacity - 1), slots(new Slot[capacity]) {}
+
+  size_t mask;
+  std::unique_ptr<Slot[]> slots;
+  uint64_t head = 0;               // lines written, owner only
+  std::atomic<uint64_t> dumped{0}; // lines below this index were dumped
+  std::atomic<bool> owned{true};
+  std::atomic<bool> dead{false}; // its recorder is gone
+  Ring* next = nullptr; // set before the ring is published
+  // lines left to write by the signal handler, it only
+  uint64_t crashNext = 0;
+  uint64_t crashEnd = 0;
+};
+
+struct FlightRecorderLogAppender::Line {
+  uint64_t timeUs;
+  uint64_t index;
+  std::string text;
+};
+
+static constexpr size_t kMaxFlightRecorders = 16;
+static std::atomic<FlightRecorderLogAppender*>
+    s_flight_recorders[kMaxFlightRecorders];
+static std::atomic<uint64_t> s_flight_recorder_id{0};
+
+/**
+ * @brief Rings used by this thread, keyed by recorder id, released for
+ * reuse when the thread exits. Rings of destroyed recorders are evicted on
+ * the next miss.
+ */
+struct FlightRecorderRings {
+  using Ring = FlightRecorderLogAppender::Ring;
+
+  ~FlightRecorderRings() {
+    for (auto& [id, ring] : rings) {
+      ring->owned.store(false, std::memory_order_release);
+    }
+  }
+
+  std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings;
+  size_t last = 0; // index of the last hit
+};
+
+static thread_local FlightRecorderRings t_flight_rings;
+
+FlightRecorderLogAppender::FlightRecorderLogAppender(
+    std::shared_ptr<LogAppender> sink, std::unique_ptr<LogFormatter> formatter,
+    LogLevel level, LogLevel triggerLevel, size_t capacity)
+    : LogAppender(std::move(formatter), level), m_sink(std::move(sink)),
+      m_triggerLevel(triggerLevel),
+      m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))),
+      m_id(s_flight_recorder_id.fetch_add(1) + 1) {
+  bool registered = false;
+  for (auto& slot : s_flight_recorders) {
+    FlightRecorderLogAppender* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, this)) {
+      registered = true;
+      break;
+    }
+  }
+  if (!registered) {
+    std::cerr << "FlightRecorderLogAppender: more than "
+              << kMaxFlightRecorders
+              << " recorders, this one is not dumped on a fatal signal"
+              << std::endl;
+  }
+  if (auto* file = dynamic_cast<FileLogAppender*>(m_sink.get())) {
+    setCrashFile(file->getFilename());
+  }
+}
+
+FlightRecorderLogAppender::FlightRecorderLogAppender(
+    std::shared_ptr<LogAppender> sink, LogLevel level, LogLevel triggerLevel,
+    size_t capacity)
+    : FlightRecorderLogAppender(std::move(sink),
+                                std::make_unique<LogFormatter>(), level,
+                                triggerLevel, capacity) {}
+
+// threads drop their reference to our rings on their next cache miss, or
+// when they exit
+FlightRecorderLogAppender::~FlightRecorderLogAppender() {
+  for (auto& slot : s_flight_recorders) {
+    FlightRecorderLogAppender* expected = this;
+    slot.compare_exchange_strong(expected, nullptr);
+  }
+  for (const auto& ring : *m_owned.lock()) {
+    ring->dead.store(true, std::memory_order_release);
+  }
+  if (m_crashFd >= 0) {
+    close(m_crashFd);
+  }
+}
+
+void FlightRecorderLogAppender::setCrashFile(const std::string& path) {
+  if (m_crashFd >= 0) {
+    close(m_crashFd);
+  }
+  m_crashFile = path;
+  m_crashFd =
+      open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+}
+
+FlightRecorderLogAppender::Ring* FlightRecorderLogAppender::getRing() {
+  auto& cache = t_flight_rings;
+  if (cache.last < cache.rings.size() &&
+      cache.rings[cache.last].first == m_id) {
+    return cache.rings[cache.last].second.get();
+  }
+  std::erase_if(cache.rings, [](const auto& entry) {
+    return entry.second->dead.load(std::memory_order_acquire);
+  });
+  for (size_t i = 0; i < cache.rings.size(); ++i) {
+    if (cache.rings[i].first == m_id) {
+      cache.last = i;
+      return cache.rings[i].second.get();
+    }
+  }
+
+  // first line of this thread, take over the ring of an exited thread
+  std::shared_ptr<Ring> ring;
+  {
+    auto owned = m_owned.lock();
+    for (const auto& candidate : *owned) {
+      bool expected = false;
+      if (candidate->owned.compare_exchange_strong(expected, true)) {
+        ring = candidate;
+        // the index goes on, so the old lines stay ordered before ours
+        ring->head = ring->dumped.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= ring->mask; ++i) {
+          uint64_t seq = ring->slots[i].seq.load(std::memory_order_relaxed);
+          ring->head = std::max(ring->head, seq / 2);
+        }
+        break;
+      }
+    }
+    if (!ring) {
+      ring = std::make_shared<Ring>(m_capacity);
+      ring->next = m_rings.load(std::memory_order_relaxed);
+      m_rings.store(ring.get(), std::memory_order_release);
+      owned->push_back(ring);
+    }
+  }
+  cache.rings.emplace_back(m_id, ring);
+  cache.last = cache.rings.size() - 1;
+  return ring.get();
+}
+
+void FlightRecorderLogAppender::append(const LogEvent& event,
+                                       std::string_view rendered) {
+  Ring* ring = getRing();
+  uint64_t index = ring->head++;
+  Slot& slot = ring->slots[index & ring->mask];
+  size_t len = std::min(rendered.size(), kSlotSize);
+
+  slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timeUs.store(event.getTimeUs(), std::memory_order_relaxed);
+  slot.len.store(len, std::memory_order_relaxed);
+  for (size_t i = 0; i * sizeof(uint64_t) < len; ++i) {
+    uint64_t word = 0;
+    std::memcpy(&word, rendered.data() + i * sizeof(uint64_t),
+                std::min(sizeof(uint64_t), len - i * sizeof(uint64_t)));
+    slot.words[i].store(word, std::memory_order_relaxed);
+  }
+  slot.seq.store(2 * index + 2, std::memory_order_release);
+
+  if (event.getLevel() >= m_triggerLevel) {
+    dump();
+  }
+}
+
+void FlightRecorderLogAppender::dump() {
+  auto guard = m_dumping.lock();
+  m_dumpBusy.store(true, std::memory_order_release);
+  try {
+    dumpLocked();
+  } catch (...) {
+    m_dumpBusy.store(false, std::memory_order_release);
+    throw;
+  }
+  m_dumpBusy.store(false, std::memory_order_release);
+}
+
+void FlightRecorderLogAppender::dumpLocked() {
+  std::vector<Line> lines;
+  for (Ring* ring = m_rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    uint64_t from = ring->dumped.load(std::memory_order_relaxed);
+    uint64_t until = from;
+    for (size_t i = 0; i <= ring->mask; ++i) {
+      Slot& slot = ring->slots[i];
+      uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == 0 || (seq & 1) || seq / 2 - 1 < from) {
+        continue;
+      }
+      Line line;
+      line.index = seq / 2 - 1;
+      line.timeUs = slot.timeUs.load(std::memory_order_relaxed);
+      size_t len = std::min<size_t>(slot.len.load(std::memory_order_relaxed),
+                                    kSlotSize);
+      line.text.resize(len);
+      for (size_t w = 0; w * sizeof(uint64_t) < len; ++w) {
+        uint64_t word = slot.words[w].load(std::memory_order_relaxed);
+        std::memcpy(line.text.data() + w * sizeof(uint64_t), &word,
+                    std::min(sizeof(uint64_t), len - w * sizeof(uint64_t)));
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != seq) {
+        continue; // overwritten meanwhile
+      }
+      until = std::max(until, line.index + 1);
+      lines.push_back(std::move(line));
+    }
+    ring->dumped.store(until, std::memory_order_relaxed);
+  }
+  if (lines.empty()) {
+    return;
+  }
+
+  std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+    return a.timeUs != b.timeUs ? a.timeUs < b.timeUs : a.index < b.index;
+  });
+  // history is written below the sink's flush level, one flush at the end
+  LogEvent event{LogLevel::DEBUG, __FILE__, __LINE__, 0, 0, 0, 0};
+  for (const auto& line : lines) {
+    m_sink->append(event, line.text);
+  }
+  m_sink->flush();
+  m_dumpedLines.fetch_add(lines.size(), std::memory_order_relaxed);
+}
+
+static struct sigaction s_flight_old_actions[NSIG];
+static std::atomic<bool> s_flight_crashing{false};
+// the line being written by the signal handler, one handler dumps at a time
+static char s_flight_crash_line[FlightRecorderLogAppender::kSlotSize];
+
+// async signal safe: no heap, no lock and no sink, the lines of all rings
+// are merged by time and written with write(2)
+void FlightRecorderLogAppender::dumpOnSignal() {
+  // the sink may hold a lock of the faulting thread, and the lines go out
+  // with that dump anyway
+  if (m_dumpBusy.load(std::memory_order_acquire)) {
+    return;
+  }
+  int fd = open(m_crashFile.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+  bool opened = fd >= 0;
+  if (!opened) {
+    fd = m_crashFd;
+  }
+  if (fd < 0) {
+    return;
+  }
+
+  for (Ring* ring = m_rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    uint64_t end = 0;
+    for (size_t i = 0; i <= ring->mask; ++i) {
+      uint64_t seq = ring->slots[i].seq.load(std::memory_order_acquire);
+      if (seq != 0 && !(seq & 1)) {
+        end = std::max(end, seq / 2);
+      }
+    }
+    uint64_t capacity = ring->mask + 1;
+    ring->crashNext = std::max(ring->dumped.load(std::memory_order_relaxed),
+                               end > capacity ? end - capacity : 0);
+    ring->crashEnd = end;
+  }
+
+  uint64_t written = 0;
+  for (;;) {
+    Ring* oldest = nullptr;
+    uint64_t oldestUs = 0;
+    for (Ring* ring = m_rings.load(std::memory_order_acquire); ring;
+         ring = ring->next) {
+      // skip lines overwritten or being written
+      while (ring->crashNext < ring->crashEnd &&
+             ring->slots[ring->crashNext & ring->mask].seq.load(
+                 std::memory_order_acquire) != 2 * ring->crashNext + 2) {
+        ++ring->crashNext;
+      }
+      if (ring->crashNext == ring->crashEnd) {
+        continue;
+      }
+      uint64_t timeUs = ring->slots[ring->crashNext & ring->mask]
+                            .timeUs.load(std::memory_order_relaxed);
+      if (!oldest || timeUs < oldestUs) {
+        oldest = ring;
+        oldestUs = timeUs;
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+
+    uint64_t index = oldest->crashNext++;
+    Slot& slot = oldest->slots[index & oldest->mask];
+    size_t len =
+        std::min<size_t>(slot.len.load(std::memory_order_relaxed), kSlotSize);
+    for (size_t w = 0; w * sizeof(uint64_t) < len; ++w) {
+      uint64_t word = slot.words[w].load(std::memory_order_relaxed);
+      std::memcpy(s_flight_crash_line + w * sizeof(uint64_t), &word,
+                  std::min(sizeof(uint64_t), len - w * sizeof(uint64_t)));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != 2 * index + 2) {
+      continue; // overwritten meanwhile
+    }
+    for (size_t done = 0; done < len;) {
+      ssize_t n = write(fd, s_flight_crash_line + done, len - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+    ++written;
+  }
+  m_dumpedLines.fetch_add(written, std::memory_order_relaxed);
+  if (opened) {
+    close(fd);
+  }
+}
+
+void FlightRecorderLogAppender::OnFatalSignal(int sig) {
+  // a second faulting thread leaves the dump to the first one
+  if (!s_flight_crashing.exchange(true)) {
+    for (auto& slot : s_flight_recorders) {
+      if (auto* recorder = slot.load(std::memory_order_acquire)) {
+        recorder->dumpOnSignal();
+      }
+    }
+  }
+  sigaction(sig, &s_flight_old_actions[sig], nullptr);
+  raise(sig);
+}
+
+void FlightRecorderLogAppender::InstallSignalHandler() {
+  static std::once_flag s_once;
+  std::call_once(s_once, []() {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnFatalSignal;
+    sigemptyset(&action.sa_mask);
+    // a fault inside the handler gets the default action
+    action.sa_flags = SA_RESETHAND;
+    for (int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+      sigaction(sig, &action, &s_flight_old_actions[sig]);
+    }
+  });
+}
+
+/**
+ * @brief Queue slot of AsyncLogWorker, the logger is kept so that events of
+ * child loggers keep their name.
+ */
+struct QueuedLogEvent {
+  const Logger* logger = nullptr;
+  LogEvent event;
+
+  // copy straight from the borrowed event into the slot
+  QueuedLogEvent& operator=(std::pair<const Logger*, const LogEvent*> src) {
+    logger = src.first;
+    event = *src.second;
+    return *this;
+  }
+};
+
+/**
+ * @brief Drain events pushed by producers and hand them to a callback on a
+ * dedicated thread.
+ */
+class AsyncLogWorker {
+public:
+  using Callback = std::function<void(const Logger&, const LogEvent&)>;
+
+  AsyncLogWorker(Callback cb, size_t queueDepth, const std::string& name)
+      : m_cb(cb), m_queue(queueDepth) {
+    m_thread.reset(new Thread{[this]() { run(); }, name});
+  }
+
+  ~AsyncLogWorker() {
+    m_stopping.store(true, std::memory_order_release);
+    m_signal.notify();
+    m_thread->join();
+  }
+
+  // copy the borrowed event into a queue slot
+  void push(const Logger& logger, const LogEvent& event) {
+    if (!m_queue.tryPush(std::make_pair(&logger, &event))) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+    m_signal.notify();
+  }
+
+  void flush() const {
+    uint64_t target = m_queued.load(std::memory_order_acquire);
+    while (m_processed.load(std::memory_order_acquire) < target) {
+      sched_yield();
+    }
+  }
+
+  uint64_t getQueuedCount() const {
+    return m_queued.load(std::memory_order_relaxed);
+  }
+  uint64_t getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  void run() {
+    DrainLogQueue(
+        m_queue, m_signal, m_queued, m_stopping,
+        [this]() { return m_processed.load(std::memory_order_acquire); },
+        [this](QueuedLogEvent& queued) {
+          m_cb(*queued.logger, queued.event);
+          m_processed.fetch_add(1, std::memory_order_release);
+        });
+  }
+
+private:
+  Callback m_cb;
+  MpmcQueue<QueuedLogEvent> m_queue;
+  Semaphore m_signal;
+  std::atomic<bool> m_stopping{false};
+  std::atomic<uint64_t> m_queued{0};    // events accepted by the queue
+  std::atomic<uint64_t> m_dropped{0};   // events rejected by a full queue
+  std::atomic<uint64_t> m_processed{0}; // events written to the appenders
+  std::unique_ptr<Thread> m_thread;
+};
+
+Logger::Logger(const std::string& name) : m_name(name) {}
+
+// stop the worker first, it drains the queue into the appenders
+Logger::~Logger() {
+  delete m_worker.load(std::memory_order_acquire);
+  for (const auto& appender : *m_appenders.lock()) {
+    appender->delOwner(this);
+  }
+  if (m_parent) {
+    auto siblings = m_parent->m_children.lock();
+    siblings->erase(std::remove(siblings->begin(), siblings->end(), this),
+                    siblings->end());
+  }
+}
+
+void Logger::log(const LogEvent& event) const {
+  Rcu::ReadGuard guard;
+  const Logger* target = m_target.load(std::memory_order_acquire);
+  if (AsyncLogWorker* worker =
+          target->m_worker.load(std::memory_order_acquire)) {
+    worker->push(*this, event);
+    return;
+  }
+  target->dispatch(*this, event);
+}
+
+// called inside a reader section
+void Logger::dispatch(const Logger& logger, const LogEvent& event) const {
+  const AppenderSet* set = m_set.load();
+  for (const auto& group : set->groups) {
+    if (event.getLevel() < group.level) {
+      continue;
+    }
+    LogStream& buf = GetFormatBuffer();
+    group.formatter->formatTo(buf, logger, event);
+    for (LogAppender* appender : group.appenders) {
+      if (event.getLevel() >= appender->getLogLevel()) {
+        appender->append(event, buf.view());
+      }
+    }
+  }
+  for (LogAppender* appender : set->unformatted) {
+    appender->log(logger, event);
+  }
+}
+
+void Logger::setAsync(size_t queueDepth) {
+  if (m_worker.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto worker = std::make_unique<AsyncLogWorker>(
+      [this](const Logger& logger, const LogEvent& event) {
+        Rcu::ReadGuard guard;
+        dispatch(logger, event);
+      },
+      queueDepth, "log_" + m_name);
+  // loggers read it without a lock, a concurrent setAsync() keeps its own
+  AsyncLogWorker* expected = nullptr;
+  if (m_worker.compare_exchange_strong(expected, worker.get(),
+                                       std::memory_order_acq_rel)) {
+    worker.release();
+  }
+}
+
+void Logger::flush() const {
+  const Logger* target = m_target.load(std::memory_order_acquire);
+  if (AsyncLogWorker* worker =
+          target->m_worker.load(std::memory_order_acquire)) {
+    worker->flush();
+  }
+  Rcu::ReadGuard guard;
+  for (const auto& appender : target->m_set.load()->appenders) {
+    appender->flush();
+  }
+}
+
+uint64_t Logger::getQueuedCount() const {
+  AsyncLogWorker* worker = m_worker.load(std::memory_order_acquire);
+  return worker ? worker->getQueuedCount() : 0;
+}
+
+uint64_t Logger::getDroppedCount() const {
+  AsyncLogWorker* worker = m_worker.load(std::memory_order_acquire);
+  return worker ? worker->getDroppedCount() : 0;
+}
+
+// owners are changed outside m_appenders, an appender locks its owners
+// first and then calls refresh()
+void Logger::addAppender(std::shared_ptr<LogAppender> appender) {
+  appender->addOwner(this);
+  m_appenders.lock()->push_back(appender);
+  refresh();
+}
+
+void Logger::delAppender(std::shared_ptr<LogAppender> appender) {
+  {
+    auto appenders = m_appenders.lock();
+    auto it = std::find(appenders->begin(), appenders->end(), appender);
+    if (it == appenders->end()) {
+      return;
+    }
+    appenders->erase(it);
+  }
+  appender->delOwner(this);
+  refresh();
+}
+
+void Logger::setAppenders(
+    std::vector<std::shared_ptr<LogAppender>> appenders) {
+  for (const auto& appender : appenders) {
+    appender->addOwner(this);
+  }
+  m_appenders.lock()->swap(appenders);
+  for (const auto& appender : appenders) {
+    appender->delOwner(this);
+  }
+  refresh();
+}
+
+std::vector<std::shared_ptr<LogAppender>> Logger::getAppenders() const {
+  return *m_appenders.lock();
+}
+
+void Logger::refresh() {
+  {
+    auto appenders = m_appenders.lock();
+    auto set = std::make_unique<AppenderSet>();
+    set->appenders = *appenders;
+    for (const auto& appender : set->appenders) {
+      LogLevel appenderLevel = appender->getLogLevel();
+      set->level = std::min(set->level, appenderLevel);
+
+      auto formatter = appender->getFormatter();
+      if (!formatter) {
+        set->unformatted.push_back(appender.get());
+        continue;
+      }
+      auto it = std::find_if(set->groups.begin(), set->groups.end(),
+                             [&formatter](const AppenderGroup& group) {
+                               return typeid(*group.formatter) ==
+                                          typeid(*formatter) &&
+                                      group.formatter->getPattern() ==
+                                          formatter->getPattern();
+                             });
+      if (it == set->groups.end()) {
+        set->groups.push_back(AppenderGroup{formatter, appenderLevel, {}});
+        it = set->groups.end() - 1;
+      }
+      it->level = std::min(it->level, appenderLevel);
+      it->appenders.push_back(appender.get());
+    }
+    // published while still locked, so sets replace each other in order
+    m_set.reset(set.release());
+  }
+  inherit();
+}
+
+void Logger::setParent(std::shared_ptr<Logger> parent) {
+  m_parent = parent;
+  m_parent->m_children.lock()->push_back(this);
+  inherit();
+}
+
+// holding m_children serializes inherit() of this logger, so the last one
+// to run sees the latest state of both the parent and this logger
+void Logger::inherit() {
+  auto children = m_children.lock();
+  const Logger* target = this;
+  LogLevel level;
+  {
+    Rcu::ReadGuard guard;
+    const AppenderSet* set = m_set.load();
+    level = set->level;
+    if (set->appenders.empty() && m_parent) {
+      target = m_parent->m_target.load(std::memory_order_acquire);
+      level = m_parent->getLevel();
+    }
+  }
+  m_target.store(target, std::memory_order_release);
+  m_level.store(level, std::memory_order_relaxed);
+
+  for (Logger* child : *children) {
+    child->inherit();
+  }
+}
+
+const std::shared_ptr<LoggerManager>& LoggerManager::GetInstance() {
+  static std::shared_ptr<LoggerManager> s_instance{new LoggerManager{}};
+  return s_instance;
+}
+
+LoggerManager::LoggerManager() {
+  m_root.reset(new Logger{});
+  m_root->addAppender(std::shared_ptr<LogAppender>{new StdoutLogAppender{}});
+
+  auto registry = m_registry.lock();
+  registry->tables.emplace_back(new Table{64});
+  m_table.store(registry->tables.back().get(), std::memory_order_release);
+  registry->loggers.emplace_back(new std::shared_ptr<Logger>{m_root});
+  insert(*registry, registry->loggers.back().get());
+}
+
+// children go first, they hold a reference to their parent
+LoggerManager::~LoggerManager() {
+  auto registry = m_registry.lock();
+  while (!registry->loggers.empty()) {
+    registry->loggers.pop_back();
+  }
+}
+
+const std::shared_ptr<Logger>*
+LoggerManager::find(std::string_view name) const {
+  const Table* table = m_table.load(std::memory_order_acquire);
+  size_t i = std::hash<std::string_view>{}(name) & table->mask;
+  for (;;) {
+    const std::shared_ptr<Logger>* logger =
+        table->slots[i].load(std::memory_order_acquire);
+    if (!logger || (*logger)->getName() == name) {
+      return logger;
+    }
+    i = (i + 1) & table->mask;
+  }
+}
+
+void LoggerManager::insert(Registry& registry,
+                           const std::shared_ptr<Logger>* logger) {
+  Table* table = registry.tables.back().get();
+  if ((table->used + 1) * 2 > table->mask + 1) {
+    // readers may still probe the old table, it stays alive in registry
+    Table* bigger = new Table{(table->mask + 1) * 2};
+    registry.tables.emplace_back(bigger);
+    for (auto& entry : registry.loggers) {
+      if (entry.get() != logger) {
+        insert(registry, entry.get());
+      }
+    }
+    m_table.store(bigger, std::memory_order_release);
+    table = bigger;
+  }
+
+  size_t i = std::hash<std::string_view>{}((*logger)->getName()) & table->mask;
+  while (table->slots[i].load(std::memory_order_relaxed)) {
+    i = (i + 1) & table->mask;
+  }
+  table->slots[i].store(logger, std::memory_order_release);
+  ++table->used;
+}
+
+const std::shared_ptr<Logger>& LoggerManager::create(Registry& registry,
+                                                     std::string_view name) {
+  if (auto logger = find(name)) {
+    return *logger;
+  }
+
+  // "a.b.c" hangs below "a.b", a name without a dot below root
+  size_t dot = name.rfind('.');
+  const std::shared_ptr<Logger>& parent =
+      dot == std::string_view::npos || dot == 0
+          ? m_root
+          : create(registry, name.substr(0, dot));
+
+  std::shared_ptr<Logger> logger{new Logger{std::string{name}}};
+  logger->setParent(parent);
+  registry.loggers.emplace_back(new std::shared_ptr<Logger>{logger});
+  insert(registry, registry.loggers.back().get());
+  return *registry.loggers.back();
+}
+
+std::shared_ptr<Logger> LoggerManager::getLogger(std::string_view name) {
+  if (auto logger = find(name)) {
+    return *logger;
+  }
+  auto registry = m_registry.lock();
+  return create(*registry, name);
+}
+
+/**
+ * @brief One appender entry of a logger in the "logs" config.
+ */
+struct LogAppenderDefine {
+  // StdoutLogAppender, FileLogAppender, MmapFileLogAppender,
+  // FlightRecorderLogAppender (dumps to a FileLogAppender of file),
+  // SocketLogAppender
+  std::string type;
+  std::string file;
+  std::string address; // SocketLogAppender
+  LogLevel level = LogLevel::UNKNOWN; // UNKNOWN: the level of the logger
+  std::string formatter; // empty: the logger's, "json": JsonLogFormatter
+  FileLogOptions options;
+  SocketLogOptions socketOptions;
+  bool async = false; // run behind an AsyncLogAppender
+  AsyncLogOptions asyncOptions;
+  size_t segmentSize = 64 * 1024 * 1024; // MmapFileLogAppender
+  // FlightRecorderLogAppender
+  size_t capacity = FlightRecorderLogAppender::kDefaultCapacity;
+  LogLevel triggerLevel = LogLevel::ERROR;
+
+  bool operator==(const LogAppenderDefine& other) const = default;
+};
+
+/**
+ * @brief A logger of the "logs" config, see conf/log.yaml.
+ */
+struct LogDefine {
+  std::string name;
+  LogLevel level = LogLevel::UNKNOWN;
+  std::string formatter;
+  std::vector<LogAppenderDefine> appenders;
+
+  bool operator==(const LogDefine& other) const = default;
+};
+
+// a bad logger or appender is skipped, the others still apply
+template <> struct ConfigConverter<std::vector<LogDefine>> {
+  static std::vector<LogDefine> FromNode(const YAML::Node& node) {
+    std::vector<LogDefine> defines;
+    for (const auto& item : node) {
+      if (!item["name"]) {
+        LOG_ERROR(ROOT_LOGGER()) << "log config error: name is null, " << item;
+        continue;
+      }
+      LogDefine define;
+      define.name = item["name"].as<std::string>();
+      if (item["level"]) {
+        define.level = parseLogLevel(item["level"].as<std::string>());
+      }
+      if (item["formatter"]) {
+        define.formatter = item["formatter"].as<std::string>();
+      }
+      for (const auto& a : item["appender"]) {
+        if (!a["type"]) {
+          LOG_ERROR(ROOT_LOGGER())
+              << "log config error: appender type is null, " << a;
+          continue;
+        }
+        LogAppenderDefine appender;
+        appender.type = a["type"].as<std::string>();
+        if (a["file"]) {
+          appender.file = a["file"].as<std::string>();
+        }
+        if (a["level"]) {
+          appender.level = parseLogLevel(a["level"].as<std::string>());
+        }
+        if (a["formatter"]) {
+          appender.formatter = a["formatter"].as<std::string>();
+        }
+        if (a["segment_size"]) {
+          appender.segmentSize = a["segment_size"].as<size_t>();
+        }
+        if (a["capacity"]) {
+          appender.capacity = a["capacity"].as<size_t>();
+        }
+        if (a["trigger_level"]) {
+          appender.triggerLevel =
+              parseLogLevel(a["trigger_level"].as<std::string>());
+        }
+        if (a["address"]) {
+          appender.address = a["address"].as<std::string>();
+        }
+        appender.options = FileLogOptions::FromYaml(a);
+        appender.socketOptions = SocketLogOptions::FromYaml(a);
+        appender.async = a["queue_depth"] || a["overflow"];
+        appender.asyncOptions = AsyncLogOptions::FromYaml(a);
+        define.appenders.push_back(appender);
+      }
+      defines.push_back(define);
+    }
+    return defines;
+  }
+
+  static YAML::Node ToNode(const std::vector<LogDefine>& v) {
+    YAML::Node node{YAML::NodeType::Sequence};
+    for (const auto& define : v) {
+      YAML::Node item;
+      item["name"] = define.name;
+      if (define.level != LogLevel::UNKNOWN) {
+        item["level"] = stringifyLogLevel(define.level);
+      }
+      if (!define.formatter.empty()) {
+        item["formatter"] = define.formatter;
+      }
+      for (const auto& appender : define.appenders) {
+        YAML::Node a;
+        a["type"] = appender.type;
+        if (!appender.file.empty()) {
+          a["file"] = appender.file;
+        }
+        if (!appender.address.empty()) {
+          a["address"] = appender.address;
+        }
+        if (appender.level != LogLevel::UNKNOWN) {
+          a["level"] = stringifyLogLevel(appender.level);
+        }
+        if (!appender.formatter.empty()) {
+          a["formatter"] = appender.formatter;
+        }
+        const LogAppenderDefine defaults;
+        if (appender.segmentSize != defaults.segmentSize) {
+          a["segment_size"] = appender.segmentSize;
+        }
+        if (appender.capacity != defaults.capacity) {
+          a["capacity"] = appender.capacity;
+        }
+        if (appender.triggerLevel != defaults.triggerLevel) {
+          a["trigger_level"] = stringifyLogLevel(appender.triggerLevel);
+        }
+        // flush_interval_ms is shared, FromNode reads it into both
+        appender.options.toYaml(a);
+        appender.socketOptions.toYaml(a);
+        appender.asyncOptions.toYaml(a);
+        // FromNode wraps the appender once either key is present
+        if (appender.async && !a["queue_depth"].IsDefined() &&
+            !a["overflow"].IsDefined()) {
+          a["queue_depth"] = appender.asyncOptions.queueDepth;
+        }
+        item["appender"].push_back(a);
+      }
+      node.push_back(item);
+    }
+    return node;
+  }
+};
+
+static std::shared_ptr<LogAppender>
+MakeLogAppender(const LogDefine& define, const LogAppenderDefine& a) {
+  LogLevel level = a.level != LogLevel::UNKNOWN ? a.level
+                   : define.level != LogLevel::UNKNOWN ? define.level
+                                                        : LogLevel::DEBUG;
+  const std::string& pattern =
+      !a.formatter.empty() ? a.formatter : define.formatter;
+  std::unique_ptr<LogFormatter> formatter;
+  if (pattern == JsonLogFormatter::kPattern) {
+    formatter = std::make_unique<JsonLogFormatter>();
+  } else if (pattern.empty()) {
+    formatter = std::make_unique<LogFormatter>();
+  } else {
+    formatter = std::make_unique<LogFormatter>(pattern);
+  }
+
+  if (a.type == "StdoutLogAppender") {
+    return std::make_shared<StdoutLogAppender>(std::move(formatter), level);
+  }
+  if (a.type == "SocketLogAppender") {
+    return std::make_shared<SocketLogAppender>(a.address, std::move(formatter),
+                                               level, a.socketOptions);
+  }
+  if (a.file.empty()) {
+    LOG_ERROR(ROOT_LOGGER()) << "log config error: " << a.type << " of "
+                             << define.name << " has no file";
+    return nullptr;
+  }
+  if (a.type == "FileLogAppender") {
+    return std::make_shared<FileLogAppender>(a.file, std::move(formatter),
+                                             level, a.options);
+  }
+  if (a.type == "MmapFileLogAppender") {
+    return std::make_shared<MmapFileLogAppender>(a.file, std::move(formatter),
+                                                 level, a.segmentSize);
+  }
+  if (a.type == "FlightRecorderLogAppender") {
+    auto sink = std::make_shared<FileLogAppender>(a.file, LogLevel::DEBUG,
+                                                  a.options);
+    return std::make_shared<FlightRecorderLogAppender>(
+        sink, std::move(formatter), level, a.triggerLevel, a.capacity);
+  }
+  LOG_ERROR(ROOT_LOGGER()) << "log config error: unknown appender type "
+                           << a.type;
+  return nullptr;
+}
+
+// rebuild the loggers whose definition changed, a removed logger loses its
+// appenders and writes through its parent again
+static void ApplyLogDefines(const std::vector<LogDefine>& oldValue,
+                            const std::vector<LogDefine>& newValue) {
+  auto byName = [](const std::vector<LogDefine>& defines,
+                   const std::string& name) {
+    return std::find_if(
+        defines.begin(), defines.end(),
+        [&name](const LogDefine& define) { return define.name == name; });
+  };
+
+  const auto& manager = LoggerManager::GetInstance();
+  for (const auto& define : newValue) {
+    auto it = byName(oldValue, define.name);
+    if (it != oldValue.end() && *it == define) {
+      continue;
+    }
+    std::vector<std::shared_ptr<LogAppender>> appenders;
+    for (const auto& a : define.appenders) {
+      try {
+        auto appender = MakeLogAppender(define, a);
+        if (appender && a.async) {
+          appender =
+              std::make_shared<AsyncLogAppender>(appender, a.asyncOptions);
+        }
+        if (appender) {
+          appenders.push_back(appender);
+        }
+      } catch (std::exception& e) {
+        LOG_ERROR(ROOT_LOGGER()) << "log config error: " << e.what();
+      }
+    }
+    manager->getLogger(define.name)->setAppenders(std::move(appenders));
+  }
+  for (const auto& define : oldValue) {
+    if (byName(newValue, define.name) == newValue.end()) {
+      manager->getLogger(define.name)->clearAppenders();
+    }
+  }
+}
+
+/**
+ * @brief Register the "logs" config var, Config::LoadFromYaml() of a file
+ * like conf/log.yaml then builds the loggers.
+ */
+struct LogConfigIniter {
+  LogConfigIniter() {
+    auto defines = Config::Lookup("logs", std::vector<LogDefine>{},
+                                  "logs config");
+    // loggers are ready when LoadFromYaml() returns
+    defines->addListener(ApplyLogDefines, ConfigDelivery::SYNC);
+  }
+};
+
+static LogConfigIniter s_log_config_initer;
+
 } // namespace cosmic
@@ -1,18 +1,38 @@
 #include "cosmic/process.h"
 
+#include <atomic>
+#include <pthread.h>
 #include <sys/syscall.h> // include all macro of syscall
 #include <unistd.h>
 
 namespace cosmic {
 
+// 0 until first use, refreshed in the child after fork()
+static std::atomic<pid_t> s_pid{0};
+static thread_local pid_t t_tid = 0;
+
+static void OnForkChild() {
+  s_pid.store(syscall(SYS_getpid), std::memory_order_relaxed);
+  // the forking thread is the only thread of the child, with a new id
+  t_tid = syscall(SYS_gettid);
+}
+
+static int s_atfork = pthread_atfork(nullptr, nullptr, OnForkChild);
+
 pid_t GetProcessId() {
-  pid_t id = syscall(SYS_getpid);
+  pid_t id = s_pid.load(std::memory_order_relaxed);
+  if (id == 0) {
+    id = syscall(SYS_getpid);
+    s_pid.store(id, std::memory_order_relaxed);
+  }
   return id;
 }
 
 pid_t GetThreadId() {
-  pid_t id = syscall(SYS_gettid);
-  return id;
+  if (t_tid == 0) {
+    t_tid = syscall(SYS_gettid);
+  }
+  return t_tid;
 }
 
 uint32_t GetFiberId() { return 0; }
@@ -0,0 +1,279 @@
+#include "cosmic/shmlog.h"
+
+#include "cosmic/clock.h"
+#include "cosmic/process.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cosmic {
+
+using shmlog::Header;
+using shmlog::kHeaderSize;
+using shmlog::Slot;
+
+// a zombie still answers kill(), it is dead for us
+static bool IsProcessAlive(pid_t pid) {
+  if (kill(pid, 0) != 0 && errno == ESRCH) {
+    return false;
+  }
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE* file = fopen(path, "re");
+  if (!file) {
+    return true;
+  }
+  char stat[256];
+  size_t n = fread(stat, 1, sizeof(stat) - 1, file);
+  fclose(file);
+  stat[n] = '\0';
+  // pid (comm) state ..., comm may contain ')'
+  const char* paren = strrchr(stat, ')');
+  return !(paren && paren[1] == ' ' && (paren[2] == 'Z' || paren[2] == 'X'));
+}
+
+SharedLogRing::SharedLogRing(int fd, void* base, size_t size)
+    : m_fd(fd), m_base(base), m_size(size), m_header((Header*)base),
+      m_slots((char*)base + kHeaderSize) {}
+
+SharedLogRing::~SharedLogRing() {
+  munmap(m_base, m_size);
+  close(m_fd);
+}
+
+std::shared_ptr<SharedLogRing>
+SharedLogRing::Create(const std::string& name, size_t slotCount,
+                      size_t slotSize) {
+  slotCount = std::bit_ceil(std::max<size_t>(slotCount, 2));
+  slotSize = (std::max(slotSize, shmlog::kSlotHeader + 8) + 7) & ~size_t(7);
+  size_t size = kHeaderSize + slotCount * slotSize;
+
+  int fd;
+  if (name.empty()) {
+    fd = memfd_create("cosmic_log_ring", MFD_CLOEXEC);
+  } else {
+    // a ring left by an earlier run is replaced, not reused
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  }
+  if (fd < 0) {
+    throw std::runtime_error("SharedLogRing create error: " + name);
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    throw std::runtime_error("SharedLogRing ftruncate error: " + name);
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("SharedLogRing mmap error: " + name);
+  }
+
+  // the mapping is zero filled, only the sequence numbers need a value
+  Header* header = new (base) Header{};
+  header->slotCount = slotCount;
+  header->slotSize = slotSize;
+  std::shared_ptr<SharedLogRing> ring{new SharedLogRing{fd, base, size}};
+  for (uint64_t pos = 0; pos < slotCount; ++pos) {
+    ring->slot(pos)->seq.store(pos, std::memory_order_relaxed);
+  }
+  // magic last, Open() refuses a ring still being built
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = shmlog::kMagic;
+  return ring;
+}
+
+std::shared_ptr<SharedLogRing> SharedLogRing::Open(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < kHeaderSize) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = st.st_size;
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  std::shared_ptr<SharedLogRing> ring{new SharedLogRing{fd, base, size}};
+  const Header* header = ring->m_header;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header->magic != shmlog::kMagic ||
+      !std::has_single_bit(header->slotCount) ||
+      header->slotSize < shmlog::kSlotHeader ||
+      kHeaderSize + header->slotCount * header->slotSize != size) {
+    return nullptr;
+  }
+  return ring;
+}
+
+void SharedLogRing::Unlink(const std::string& name) {
+  shm_unlink(name.c_str());
+}
+
+bool SharedLogRing::push(LogLevel level, uint64_t timeUs,
+                         std::string_view line) {
+  Header* header = m_header;
+  Slot* s;
+  uint64_t pos = header->tail.load(std::memory_order_relaxed);
+  for (;;) {
+    s = slot(pos);
+    uint64_t seq = s->seq.load(std::memory_order_acquire);
+    int64_t diff = (int64_t)(seq - pos);
+    if (diff == 0) {
+      if (header->tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      header->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = header->tail.load(std::memory_order_relaxed);
+    }
+  }
+
+  // reserve before writing, fails when the collector took the slot back
+  // while we were stopped between the two CASes
+  uint64_t expected = pos;
+  uint64_t writing = shmlog::Writing(GetProcessId());
+  if (!s->seq.compare_exchange_strong(expected, writing,
+                                      std::memory_order_acquire)) {
+    header->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  size_t len = std::min(line.size(), getMaxLine());
+  s->level = (uint8_t)level;
+  s->len = len;
+  s->timeUs = timeUs;
+  std::memcpy((char*)s + shmlog::kSlotHeader, line.data(), len);
+  // only fails if we were taken for dead, a reused pid
+  if (!s->seq.compare_exchange_strong(writing, pos + 1,
+                                      std::memory_order_release)) {
+    header->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+bool SharedLogRing::isOrphaned(uint64_t pos) {
+  uint64_t now = GetMonotonicUs();
+  if (m_stuckPos != pos) {
+    m_stuckPos = pos;
+    m_stuckSinceUs = now;
+    return false;
+  }
+  return now - m_stuckSinceUs >= kOrphanMs * 1000;
+}
+
+size_t SharedLogRing::drain(const Callback& cb) {
+  Header* header = m_header;
+  size_t count = 0;
+  uint64_t pos = header->head.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot* s = slot(pos);
+    uint64_t seq = s->seq.load(std::memory_order_acquire);
+    if (seq == pos + 1) {
+      size_t len = std::min<size_t>(s->len, getMaxLine());
+      cb((LogLevel)s->level, s->timeUs,
+         std::string_view{(char*)s + shmlog::kSlotHeader, len});
+      ++count;
+      s->seq.store(pos + header->slotCount, std::memory_order_release);
+      header->head.store(++pos, std::memory_order_relaxed);
+      continue;
+    }
+
+    bool abandoned;
+    if (seq & shmlog::kWritingBit) {
+      abandoned = !IsProcessAlive((pid_t)(uint32_t)seq);
+    } else {
+      abandoned = seq == pos &&
+                  header->tail.load(std::memory_order_acquire) > pos &&
+                  isOrphaned(pos);
+    }
+    if (!abandoned) {
+      break;
+    }
+    // take the slot back, a late reservation or commit of its producer
+    // now fails
+    if (!s->seq.compare_exchange_strong(seq, pos + header->slotCount,
+                                        std::memory_order_acq_rel)) {
+      continue; // reserved or committed meanwhile
+    }
+    m_stuckPos = ~0ull;
+    header->abandoned.fetch_add(1, std::memory_order_relaxed);
+    header->head.store(++pos, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+SharedLogAppender::SharedLogAppender(std::shared_ptr<SharedLogRing> ring,
+                                     std::unique_ptr<LogFormatter> formatter,
+                                     LogLevel level)
+    : LogAppender(std::move(formatter), level), m_ring(std::move(ring)) {}
+
+SharedLogAppender::SharedLogAppender(std::shared_ptr<SharedLogRing> ring,
+                                     LogLevel level)
+    : LogAppender(level), m_ring(std::move(ring)) {}
+
+void SharedLogAppender::append(const LogEvent& event,
+                               std::string_view rendered) {
+  m_ring->push(event.getLevel(), event.getTimeUs(), rendered);
+}
+
+SharedLogCollector::SharedLogCollector(
+    std::shared_ptr<SharedLogRing> ring,
+    std::vector<std::shared_ptr<LogAppender>> appenders,
+    uint32_t pollIntervalMs)
+    : m_ring(std::move(ring)), m_appenders(std::move(appenders)),
+      m_pollIntervalMs(pollIntervalMs > 0 ? pollIntervalMs : 10) {
+  m_thread.reset(new Thread{[this]() { run(); }, "log_collect"});
+}
+
+SharedLogCollector::~SharedLogCollector() {
+  m_stopping.store(true, std::memory_order_release);
+  m_signal.notify();
+  m_thread->join();
+  drain();
+  for (const auto& appender : m_appenders) {
+    appender->flush();
+  }
+}
+
+size_t SharedLogCollector::drain() {
+  auto event = m_event.lock();
+  size_t count = m_ring->drain(
+      [this, &event](LogLevel level, uint64_t timeUs, std::string_view line) {
+        event->reset(level, "", 0, 0, 0, 0, timeUs);
+        for (const auto& appender : m_appenders) {
+          if (level >= appender->getLogLevel()) {
+            appender->append(*event, line);
+          }
+        }
+      });
+  m_collected.fetch_add(count, std::memory_order_relaxed);
+  return count;
+}
+
+void SharedLogCollector::run() {
+  while (!m_stopping.load(std::memory_order_acquire)) {
+    if (drain() == 0) {
+      m_signal.waitFor(m_pollIntervalMs);
+    }
+  }
+}
+
+} // namespace cosmic
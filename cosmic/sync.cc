@@ -1,7 +1,14 @@
 #include "cosmic/sync.h"
+#include "cosmic/thread.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <sched.h>
+#include <ctime>
+#include <iterator>
 #include <semaphore.h>
 #include <stdexcept>
+#include <vector>
 
 namespace cosmic {
 
@@ -28,6 +35,30 @@ void Semaphore::wait() {
   }
 }
 
+bool Semaphore::waitFor(uint64_t ms) {
+  // sem_timedwait takes an absolute CLOCK_REALTIME deadline
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ms / 1000;
+  deadline.tv_nsec += (ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  for (;;) {
+    if (sem_timedwait(&m_semaphore, &deadline) == 0) {
+      return true;
+    }
+    if (errno == ETIMEDOUT) {
+      return false;
+    }
+    if (errno != EINTR) {
+      throw std::runtime_error("sem_timedwait error");
+    }
+  }
+}
+
 void Semaphore::notify() {
   // sem_post will increase by 1 semaphore.
   int res = sem_post(&m_semaphore);
@@ -37,4 +68,178 @@ void Semaphore::notify() {
   }
 }
 
+/**
+ * @brief Reader state of one thread, records are never freed and are
+ * reused by later threads.
+ */
+struct RcuRecord {
+  std::atomic<uint64_t> active{0}; // epoch seen on entry, 0 when outside
+  std::atomic<bool> used{true};
+  RcuRecord* next = nullptr;
+};
+
+static std::atomic<RcuRecord*> s_rcu_records{nullptr};
+static std::atomic<uint64_t> s_rcu_epoch{1};
+
+static RcuRecord* AcquireRcuRecord() {
+  for (RcuRecord* record = s_rcu_records.load(std::memory_order_acquire);
+       record; record = record->next) {
+    bool used = false;
+    if (record->used.compare_exchange_strong(used, true)) {
+      return record;
+    }
+  }
+  RcuRecord* record = new RcuRecord{};
+  record->next = s_rcu_records.load(std::memory_order_relaxed);
+  while (!s_rcu_records.compare_exchange_weak(record->next, record,
+                                              std::memory_order_release)) {
+  }
+  return record;
+}
+
+struct RcuThreadState {
+  RcuRecord* record = nullptr;
+  int depth = 0;
+  ~RcuThreadState() {
+    if (record) {
+      record->active.store(0, std::memory_order_release);
+      record->used.store(false, std::memory_order_release);
+    }
+  }
+};
+
+static thread_local RcuThreadState t_rcu;
+
+void Rcu::Enter() {
+  if (t_rcu.depth++ > 0) {
+    return;
+  }
+  if (!t_rcu.record) {
+    t_rcu.record = AcquireRcuRecord();
+  }
+  t_rcu.record->active.store(s_rcu_epoch.load(std::memory_order_acquire),
+                             std::memory_order_relaxed);
+  // order the store before the loads of protected pointers
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void Rcu::Leave() {
+  if (--t_rcu.depth == 0) {
+    t_rcu.record->active.store(0, std::memory_order_release);
+  }
+}
+
+void Rcu::Synchronize() {
+  uint64_t target = s_rcu_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  // a reader which entered after the bump sees the new pointer
+  for (RcuRecord* record = s_rcu_records.load(std::memory_order_acquire);
+       record; record = record->next) {
+    for (;;) {
+      uint64_t active = record->active.load(std::memory_order_acquire);
+      if (active == 0 || active >= target) {
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+// set once the reclaimer is destroyed, Retire() then waits in place
+static std::atomic<bool> s_rcu_reclaimer_done{false};
+
+/**
+ * @brief Frees retired objects in the background once their grace period
+ * has passed, stopped and joined at exit.
+ */
+class RcuReclaimer {
+public:
+  RcuReclaimer() : m_thread{[this]() { run(); }, "rcu_reclaim"} {}
+
+  ~RcuReclaimer() {
+    m_stopping.store(true, std::memory_order_release);
+    m_signal.notify();
+    m_thread.join();
+    s_rcu_reclaimer_done.store(true, std::memory_order_release);
+    // what is still read at exit is leaked
+  }
+
+  void retire(std::function<void()> free) {
+    uint64_t epoch = s_rcu_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool wake;
+    {
+      auto pending = m_pending.lock();
+      wake = pending->empty();
+      pending->push_back(Retired{epoch, std::move(free)});
+    }
+    if (wake) {
+      m_signal.notify();
+    }
+  }
+
+private:
+  struct Retired {
+    uint64_t epoch; // the bump which made the object unreachable
+    std::function<void()> free;
+  };
+
+  void run() {
+    for (;;) {
+      bool idle = m_pending.lock()->empty();
+      if (idle) {
+        m_signal.wait();
+      } else {
+        m_signal.waitFor(1);
+      }
+      reclaim();
+      if (m_stopping.load(std::memory_order_acquire)) {
+        break;
+      }
+    }
+  }
+
+  void reclaim() {
+    // the oldest epoch a reader section is still in, as in Synchronize()
+    uint64_t oldest = ~0ull;
+    for (RcuRecord* record = s_rcu_records.load(std::memory_order_acquire);
+         record; record = record->next) {
+      uint64_t active = record->active.load(std::memory_order_acquire);
+      if (active != 0) {
+        oldest = std::min(oldest, active);
+      }
+    }
+
+    std::vector<Retired> ready;
+    {
+      auto pending = m_pending.lock();
+      auto it = std::partition(
+          pending->begin(), pending->end(),
+          [oldest](const Retired& retired) { return retired.epoch > oldest; });
+      std::move(it, pending->end(), std::back_inserter(ready));
+      pending->erase(it, pending->end());
+    }
+    // frees may log or retire again, run them unlocked
+    for (Retired& retired : ready) {
+      retired.free();
+    }
+  }
+
+private:
+  Mutex<std::vector<Retired>> m_pending{std::vector<Retired>{}};
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  Thread m_thread;
+};
+
+void Rcu::Retire(std::function<void()> free) {
+  if (s_rcu_reclaimer_done.load(std::memory_order_acquire)) {
+    Synchronize();
+    free();
+    return;
+  }
+  static RcuReclaimer s_reclaimer;
+  s_reclaimer.retire(std::move(free));
+}
+
 } 
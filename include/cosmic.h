@@ -1,7 +1,11 @@
 #pragma once
 
+#include "cosmic/binlog.h"
+#include "cosmic/clock.h"
+#include "cosmic/compress.h"
 #include "cosmic/config.h"
 #include "cosmic/log.h"
 #include "cosmic/process.h"
+#include "cosmic/shmlog.h"
 #include "cosmic/sync.h"
 #include "cosmic/thread.h"
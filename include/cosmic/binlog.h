@@ -0,0 +1,286 @@
+#pragma once
+
+#include "cosmic/clock.h"
+#include "cosmic/log.h"
+#include "cosmic/process.h"
+#include "cosmic/sync.h"
+#include "cosmic/thread.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Deferred formatting: the call site registers (level, file, line, format)
+// once and a line only stores the site id, time, thread id and raw
+// arguments. Placeholders in fmt are {}, cosmic-logdecode renders them.
+#define LOG_BIN(binlogger, level, fmt, ...)                                    \
+  do {                                                                         \
+    static const uint32_t s_cosmic_binlog_site =                               \
+        cosmic::BinLogger::RegisterSite(level, __FILE__, __LINE__, fmt);       \
+    if ((binlogger).isEnabled(level)) {                                        \
+      (binlogger).log(s_cosmic_binlog_site, ##__VA_ARGS__);                    \
+    }                                                                          \
+  } while (0)
+
+#define LOG_BIN_DEBUG(binlogger, fmt, ...)                                     \
+  LOG_BIN(binlogger, cosmic::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_BIN_INFO(binlogger, fmt, ...)                                      \
+  LOG_BIN(binlogger, cosmic::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LOG_BIN_WARN(binlogger, fmt, ...)                                      \
+  LOG_BIN(binlogger, cosmic::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LOG_BIN_ERROR(binlogger, fmt, ...)                                     \
+  LOG_BIN(binlogger, cosmic::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LOG_BIN_FATAL(binlogger, fmt, ...)                                     \
+  LOG_BIN(binlogger, cosmic::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace cosmic {
+
+/**
+ * @brief On disk layout of a binary log file, every entry is 8 byte aligned
+ * and starts with its length and a site id.
+ *
+ *   file   := magic[8] u16 nameLen name entry*
+ *   entry  := u32 len, u32 site, body
+ *   site   := kSiteMeta: u32 id, u8 level, i32 line, u16 fileLen, file,
+ *                        u16 fmtLen, fmt
+ *             kPadding:  nothing, skip len bytes
+ *             id:        u64 timeUs, u32 threadId, arg*
+ *   arg    := u8 type, payload
+ */
+namespace binlog {
+constexpr char kMagic[8] = {'C', 'O', 'S', 'M', 'B', 'L', 'G', '1'};
+constexpr uint32_t kSiteMeta = 0xFFFFFFFF;
+constexpr uint32_t kPadding = 0xFFFFFFFE;
+constexpr size_t kRecordHeader = 4 + 4 + 8 + 4;
+
+enum class ArgType : uint8_t {
+  INT = 1,    // i64
+  UINT = 2,   // u64
+  DOUBLE = 3, // f64
+  BOOL = 4,   // u8
+  CHAR = 5,   // u8
+  STRING = 6, // u32 len, bytes
+  POINTER = 7 // u64
+};
+
+constexpr size_t Align(size_t size) { return (size + 7) & ~(size_t)7; }
+
+template <class U>
+constexpr bool kIsCString =
+    std::is_same_v<U, const char*> || std::is_same_v<U, char*>;
+
+template <class T> std::string_view ToStringView(const T& v) {
+  if constexpr (std::is_array_v<T>) {
+    return std::string_view{v};
+  } else if constexpr (kIsCString<T>) {
+    return v ? std::string_view{v} : std::string_view{"(null)"};
+  } else {
+    return std::string_view{v};
+  }
+}
+
+template <class T> size_t ArgSize(const T& v) {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, char>) {
+    return 2;
+  } else if constexpr (std::is_arithmetic_v<U> ||
+                       (std::is_pointer_v<U> && !kIsCString<U>)) {
+    return 9;
+  } else {
+    return 5 + ToStringView(v).size();
+  }
+}
+
+template <class T> char* ArgWrite(char* p, const T& v) {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, bool>) {
+    *p++ = (char)ArgType::BOOL;
+    *p++ = v ? 1 : 0;
+  } else if constexpr (std::is_same_v<U, char>) {
+    *p++ = (char)ArgType::CHAR;
+    *p++ = v;
+  } else if constexpr (std::is_floating_point_v<U>) {
+    double d = v;
+    *p++ = (char)ArgType::DOUBLE;
+    std::memcpy(p, &d, 8);
+    p += 8;
+  } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+    int64_t i = v;
+    *p++ = (char)ArgType::INT;
+    std::memcpy(p, &i, 8);
+    p += 8;
+  } else if constexpr (std::is_integral_v<U>) {
+    uint64_t u = v;
+    *p++ = (char)ArgType::UINT;
+    std::memcpy(p, &u, 8);
+    p += 8;
+  } else if constexpr (std::is_pointer_v<U> && !kIsCString<U>) {
+    uint64_t u = (uintptr_t)v;
+    *p++ = (char)ArgType::POINTER;
+    std::memcpy(p, &u, 8);
+    p += 8;
+  } else {
+    std::string_view str = ToStringView(v);
+    uint32_t len = str.size();
+    *p++ = (char)ArgType::STRING;
+    std::memcpy(p, &len, 4);
+    std::memcpy(p + 4, str.data(), len);
+    p += 4 + len;
+  }
+  return p;
+}
+} // namespace binlog
+
+/**
+ * @brief Single producer byte ring a thread stages its records in.
+ */
+class BinLogBuffer {
+public:
+  explicit BinLogBuffer(size_t capacity);
+
+  // reserve size bytes (8 byte aligned) contiguously, nullptr when full
+  char* reserve(size_t size);
+  void commit(size_t size) {
+    m_head.store(m_head.load(std::memory_order_relaxed) + size,
+                 std::memory_order_release);
+  }
+
+  // consumer side: bytes between tail and head, maybe in two pieces
+  size_t peek(const char** first, size_t* firstLen, const char** second,
+              size_t* secondLen) const;
+  void consume(size_t size) {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + size,
+                 std::memory_order_release);
+  }
+
+  bool isRetired() const { return m_retired.load(std::memory_order_acquire); }
+  void retire() { m_retired.store(true, std::memory_order_release); }
+
+  // the logger is gone: the ring is freed, the thread cache drops the rest
+  bool isDetached() const {
+    return m_detached.load(std::memory_order_acquire);
+  }
+  void detach();
+
+private:
+  std::unique_ptr<char[]> m_data;
+  size_t m_capacity;
+  alignas(64) std::atomic<uint64_t> m_head{0}; // written by the producer
+  alignas(64) std::atomic<uint64_t> m_tail{0}; // written by the consumer
+  std::atomic<bool> m_retired{false};          // producer thread exited
+  std::atomic<bool> m_detached{false};         // logger destroyed
+};
+
+/**
+ * @brief Binary logger, producers write records into a per-thread buffer
+ * and a background thread appends them to the file. A line is dropped and
+ * counted when its thread buffer is full.
+ */
+class BinLogger {
+public:
+  BinLogger(const std::string& name, const std::string& path,
+            LogLevel level = LogLevel::DEBUG,
+            size_t threadBufferSize = 256 * 1024);
+  ~BinLogger();
+
+  static uint32_t RegisterSite(LogLevel level, const char* file, int32_t line,
+                               const char* format);
+
+  bool isEnabled(LogLevel level) const {
+    return level >= m_level.load(std::memory_order_relaxed);
+  }
+  void setLevel(LogLevel level) {
+    m_level.store(level, std::memory_order_relaxed);
+  }
+
+  template <class... Args> void log(uint32_t site, const Args&... args) {
+    size_t size = binlog::kRecordHeader + (binlog::ArgSize(args) + ... + 0);
+    size_t aligned = binlog::Align(size);
+    BinLogBuffer* buffer = getThreadBuffer();
+    char* p = buffer->reserve(aligned);
+    if (!p) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    uint32_t len = aligned;
+    uint64_t timeUs = GetCurrentUs();
+    uint32_t threadId = GetThreadId();
+    std::memcpy(p, &len, 4);
+    std::memcpy(p + 4, &site, 4);
+    std::memcpy(p + 8, &timeUs, 8);
+    std::memcpy(p + 16, &threadId, 4);
+    char* end = p + binlog::kRecordHeader;
+    ((end = binlog::ArgWrite(end, args)), ...);
+    std::memset(end, 0, aligned - size);
+    buffer->commit(aligned);
+  }
+
+  // write everything staged so far
+  void flush();
+  uint64_t getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+  const std::string& getName() const { return m_name; }
+
+private:
+  BinLogBuffer* getThreadBuffer();
+  void drain();
+  void run();
+
+private:
+  struct Output {
+    int fd = -1;
+    uint32_t sites = 0; // site metadata already written
+  };
+
+  std::string m_name;
+  uint64_t m_id; // unique per instance, keys the thread local cache
+  size_t m_threadBufferSize;
+  std::atomic<LogLevel> m_level;
+  std::atomic<uint64_t> m_dropped{0};
+  Mutex<Output> m_output{Output{}}; // held across the writes of drain()
+  // a new thread registers here, never waiting on file I/O
+  Mutex<std::vector<std::shared_ptr<BinLogBuffer>>> m_buffers{
+      std::vector<std::shared_ptr<BinLogBuffer>>{}};
+
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  std::unique_ptr<Thread> m_thread;
+};
+
+/**
+ * @brief Read a binary log file back and render it with a LogFormatter.
+ */
+class BinLogReader {
+public:
+  explicit BinLogReader(const std::string& path);
+
+  bool isValid() const { return m_valid; }
+  // format every record with the pattern, in file order
+  bool decode(const LogFormatter& formatter, std::ostream& os);
+
+  // expand {} placeholders, exposed for tests
+  static void FormatMessage(LogStream& out, std::string_view format,
+                            const char* args, const char* end);
+
+private:
+  struct Site {
+    LogLevel level;
+    int32_t line;
+    std::string file;
+    std::string format;
+  };
+
+  bool m_valid = false;
+  std::string m_name;
+  std::string m_data;
+  size_t m_offset = 0;
+  std::vector<Site> m_sites;
+};
+
+} // namespace cosmic
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COSMIC_HAVE_TSC 1
+#endif
+
+namespace cosmic {
+
+// wall clock time in microseconds since the epoch, read from the calibrated
+// TSC when it is invariant, from CLOCK_REALTIME_COARSE otherwise
+uint64_t GetCurrentUs();
+
+// monotonic time in microseconds, for measuring intervals
+uint64_t GetMonotonicUs();
+// CLOCK_MONOTONIC_COARSE in microseconds, a few ms resolution but only a
+// read of the vDSO data page
+uint64_t GetCoarseMonotonicUs();
+
+// milliseconds since the library was loaded
+uint32_t GetUptimeMs();
+
+#ifdef COSMIC_HAVE_TSC
+
+/**
+ * @brief Wall clock extrapolated from the TSC, behind GetCurrentUs().
+ *
+ * A reading is one rdtsc and a multiply. The tick rate is measured against
+ * CLOCK_MONOTONIC_RAW over the whole window since the first anchor, so
+ * steps of the wall clock never skew it. The base point is re-anchored to
+ * the wall clock about once a second, so NTP steps are followed. The state
+ * is published with a seqlock, readers never block.
+ */
+class TscClock {
+public:
+  using WallClock = uint64_t (*)(); // nanoseconds since the epoch
+
+  // wall defaults to CLOCK_REALTIME
+  explicit TscClock(WallClock wall = nullptr);
+
+  bool enabled() const { return m_enabled; }
+  uint64_t nowNs();
+  double getNsPerTick() const {
+    return m_nsPerTick.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr double kResyncNs = 1e9;
+
+  static bool HasInvariantTsc();
+  // tsc with the wall and the raw monotonic time at the same instant
+  void sample(uint64_t& tsc, uint64_t& wallNs, uint64_t& rawNs) const;
+  void calibrate();
+  uint64_t resync(uint64_t seq);
+
+  WallClock m_wall;
+  bool m_enabled;
+  uint64_t m_firstTsc = 0; // first anchor, fixed after calibration
+  uint64_t m_firstRawNs = 0;
+  std::atomic<uint64_t> m_seq{0};
+  std::atomic<uint64_t> m_baseTsc{0};
+  std::atomic<uint64_t> m_baseNs{0};
+  std::atomic<double> m_nsPerTick{0};
+};
+
+#endif // COSMIC_HAVE_TSC
+
+} // namespace cosmic
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cosmic {
+
+/**
+ * @brief Streaming gzip (RFC 1952) writer. Deflate blocks use LZ77 with the
+ * fixed Huffman codes, good enough for log text and without dependency.
+ */
+class GzipWriter {
+public:
+  GzipWriter();
+
+  // compress data and append the output to out
+  void write(std::string_view data, std::string& out);
+  // end the stream, append the last block and the gzip trailer to out
+  void finish(std::string& out);
+
+private:
+  void writeBits(uint32_t bits, int count, std::string& out);
+  void writeHuffman(uint32_t code, int count, std::string& out);
+  void writeLiteral(uint8_t c, std::string& out);
+  void writeMatch(uint32_t length, uint32_t distance, std::string& out);
+  void deflateBlock(std::string_view data, bool final, std::string& out);
+
+private:
+  uint32_t m_crc = 0;
+  uint32_t m_size = 0; // input size modulo 2^32
+  uint64_t m_bitBuf = 0;
+  int m_bitCount = 0;
+  bool m_headerDone = false;
+};
+
+uint32_t Crc32(uint32_t crc, const void* data, size_t len);
+
+// compress src into dst, return false on I/O error
+bool GzipFile(const std::string& src, const std::string& dst);
+
+} // namespace cosmic
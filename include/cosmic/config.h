@@ -1,112 +1,541 @@
 #pragma once
 
 #include "cosmic/log.h"
-#include <boost/lexical_cast.hpp>
+#include "cosmic/sync.h"
+#include "cosmic/thread.h"
+#include <atomic>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 namespace cosmic {
 
+/**
+ * @brief Convert a config value from and to YAML.
+ *
+ * A converter has `static T FromNode(const YAML::Node&)`, which throws on a
+ * bad node, and `static YAML::Node ToNode(const T&)`. Scalars also have
+ * FromString()/ToString(), which skip YAML. Arithmetic types, bool,
+ * std::string and the STL containers of convertible types are handled
+ * here; specialize ConfigConverter for a user type.
+ */
+template <class T> struct ConfigConverter;
+
+template <class T>
+concept ConfigScalar = requires(std::string_view str, const T& v) {
+  { ConfigConverter<T>::FromString(str) } -> std::same_as<T>;
+  { ConfigConverter<T>::ToString(v) } -> std::same_as<std::string>;
+};
+
+template <class T> T ConfigFromNode(const YAML::Node& node) {
+  return ConfigConverter<T>::FromNode(node);
+}
+
+template <class T> YAML::Node ConfigToNode(const T& v) {
+  return ConfigConverter<T>::ToNode(v);
+}
+
+template <class T> T ConfigFromString(const std::string& str) {
+  if constexpr (ConfigScalar<T>) {
+    return ConfigConverter<T>::FromString(str);
+  } else {
+    return ConfigConverter<T>::FromNode(YAML::Load(str));
+  }
+}
+
+template <class T> std::string ConfigToString(const T& v) {
+  if constexpr (ConfigScalar<T>) {
+    return ConfigConverter<T>::ToString(v);
+  } else {
+    YAML::Emitter out;
+    out << ConfigConverter<T>::ToNode(v);
+    return out.c_str();
+  }
+}
+
+// the scalar of node, throw when node is a map or a sequence
+const std::string& ConfigScalarOf(const YAML::Node& node);
+
+template <class T>
+  requires std::integral<T> || std::floating_point<T>
+struct ConfigConverter<T> {
+  static T FromString(std::string_view str) {
+    // YAML allows "+1", from_chars does not
+    if (str.size() > 1 && str[0] == '+' && str[1] != '-') {
+      str.remove_prefix(1);
+    }
+    T v{};
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), v);
+    if (ec != std::errc{} || end != str.data() + str.size()) {
+      throw std::invalid_argument("not a number: " + std::string{str});
+    }
+    return v;
+  }
+  static std::string ToString(const T& v) {
+    char buf[64];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+    return std::string{buf, end};
+  }
+  static T FromNode(const YAML::Node& node) {
+    return FromString(ConfigScalarOf(node));
+  }
+  static YAML::Node ToNode(const T& v) { return YAML::Node{ToString(v)}; }
+};
+
+template <> struct ConfigConverter<bool> {
+  // true/false, yes/no, on/off and 1/0 in any case
+  static bool FromString(std::string_view str);
+  static std::string ToString(const bool& v) { return v ? "true" : "false"; }
+  static bool FromNode(const YAML::Node& node) {
+    return FromString(ConfigScalarOf(node));
+  }
+  static YAML::Node ToNode(const bool& v) { return YAML::Node{ToString(v)}; }
+};
+
+template <> struct ConfigConverter<std::string> {
+  static std::string FromString(std::string_view str) {
+    return std::string{str};
+  }
+  static std::string ToString(const std::string& v) { return v; }
+  static std::string FromNode(const YAML::Node& node) {
+    return ConfigScalarOf(node);
+  }
+  static YAML::Node ToNode(const std::string& v) { return YAML::Node{v}; }
+};
+
+/**
+ * @brief Sequence containers and sets, from a YAML sequence; null is an
+ * empty container.
+ */
+template <class C, class T> struct ConfigSequenceConverter {
+  static C FromNode(const YAML::Node& node) {
+    C c;
+    if (node.IsNull()) {
+      return c;
+    }
+    if (!node.IsSequence()) {
+      throw std::invalid_argument("not a sequence");
+    }
+    for (const auto& item : node) {
+      c.insert(c.end(), ConfigFromNode<T>(item));
+    }
+    return c;
+  }
+  static YAML::Node ToNode(const C& c) {
+    YAML::Node node{YAML::NodeType::Sequence};
+    for (const auto& item : c) {
+      node.push_back(ConfigToNode<T>(item));
+    }
+    return node;
+  }
+};
+
+/**
+ * @brief Maps, from a YAML map; null is an empty map.
+ */
+template <class C, class K, class V> struct ConfigMapConverter {
+  static C FromNode(const YAML::Node& node) {
+    C c;
+    if (node.IsNull()) {
+      return c;
+    }
+    if (!node.IsMap()) {
+      throw std::invalid_argument("not a map");
+    }
+    for (auto it = node.begin(); it != node.end(); ++it) {
+      c.insert_or_assign(ConfigFromNode<K>(it->first),
+                         ConfigFromNode<V>(it->second));
+    }
+    return c;
+  }
+  static YAML::Node ToNode(const C& c) {
+    YAML::Node node{YAML::NodeType::Map};
+    for (const auto& [key, value] : c) {
+      node[ConfigToNode<K>(key)] = ConfigToNode<V>(value);
+    }
+    return node;
+  }
+};
+
+template <class T>
+struct ConfigConverter<std::vector<T>>
+    : ConfigSequenceConverter<std::vector<T>, T> {};
+template <class T>
+struct ConfigConverter<std::list<T>>
+    : ConfigSequenceConverter<std::list<T>, T> {};
+template <class T>
+struct ConfigConverter<std::set<T>> : ConfigSequenceConverter<std::set<T>, T> {
+};
+template <class T>
+struct ConfigConverter<std::unordered_set<T>>
+    : ConfigSequenceConverter<std::unordered_set<T>, T> {};
+template <class K, class V>
+struct ConfigConverter<std::map<K, V>>
+    : ConfigMapConverter<std::map<K, V>, K, V> {};
+template <class K, class V>
+struct ConfigConverter<std::unordered_map<K, V>>
+    : ConfigMapConverter<std::unordered_map<K, V>, K, V> {};
+
+/**
+ * @brief Identity of the value type of a var, compared instead of a
+ * dynamic_cast.
+ */
+using ConfigTypeTag = const void*;
+
+template <class T> ConfigTypeTag GetConfigTypeTag() {
+  static const char s_tag = 0;
+  return &s_tag;
+}
+
 class ConfigVarBase {
 public:
   using ptr = std::shared_ptr<ConfigVarBase>;
-  ConfigVarBase(const std::string& name, const std::string& desc = "")
-      : m_name(name), m_desc(desc) {}
+  ConfigVarBase(const std::string& name, const std::string& desc,
+                ConfigTypeTag type)
+      : m_name(name), m_desc(desc), m_type(type) {}
   virtual ~ConfigVarBase() {};
 
   const std::string& getName() const { return m_name; }
   const std::string& getDescription() const { return m_desc; }
+  ConfigTypeTag getTypeTag() const { return m_type; }
 
   virtual std::string toString() = 0;
   virtual bool fromString(const std::string& val) = 0;
+  // false, and the value is kept, when node does not convert
+  virtual bool fromNode(const YAML::Node& node) = 0;
 
 private:
   std::string m_name;
   std::string m_desc;
+  ConfigTypeTag m_type;
+};
+
+/**
+ * @brief How a ConfigVar listener is called.
+ */
+enum class ConfigDelivery {
+  ASYNC, // later, on the dispatcher thread, batched per reload
+  SYNC,  // right away, on the thread which changed the value
+};
+
+/**
+ * @brief The thread which runs asynchronous ConfigVar listeners.
+ *
+ * Notifications posted while a Batch is alive on the posting thread are
+ * queued together when the outermost Batch ends, so the listeners of one
+ * reload run back to back on the dispatcher thread, in the order of the
+ * changes. Without a Batch every change is a batch of its own.
+ */
+class ConfigDispatcher {
+public:
+  class Batch {
+  public:
+    Batch();
+    ~Batch();
+
+  private:
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+  };
+
+  static void Post(std::function<void()> fn);
+  // wait until everything posted before ran; not from a listener
+  static void Flush();
 };
 
+/**
+ * @brief A named config value.
+ *
+ * The value is an immutable snapshot published through an atomic
+ * shared_ptr: readers take a handle without a copy of T, and writers build
+ * a new snapshot and swap it in. std::atomic<std::shared_ptr> is not lock
+ * free in libstdc++, snapshot() takes its internal spinlock for the
+ * refcount. getVersion() changes after every swap, so a Reader keeps its
+ * handle and reloads only then: Reader::get() is the lock-free read.
+ *
+ * setValue() skips an equal value when T has operator==, without it every
+ * setValue() publishes and notifies.
+ */
 template <class T> class ConfigVar : public ConfigVarBase {
 public:
   using ptr = std::shared_ptr<ConfigVar<T>>;
+  using Snapshot = std::shared_ptr<const T>;
+  using OnChange = std::function<void(const T& oldValue, const T& newValue)>;
+
+  /**
+   * @brief Cached view of a var for one thread, get() costs an atomic load
+   * until the var changes.
+   */
+  class Reader {
+  public:
+    explicit Reader(const ConfigVar& var) : m_var(var) {}
+
+    const T& get() {
+      uint64_t version = m_var.getVersion();
+      if (version != m_version || !m_value) {
+        m_value = m_var.snapshot();
+        m_version = version;
+      }
+      return *m_value;
+    }
+
+  private:
+    const ConfigVar& m_var;
+    uint64_t m_version = 0;
+    Snapshot m_value;
+  };
 
   ConfigVar(const std::string& name, const T& default_value,
             const std::string& desc = "")
-      : ConfigVarBase(name, desc), m_val(default_value) {}
+      : ConfigVarBase(name, desc, GetConfigTypeTag<T>()),
+        m_snapshot(std::make_shared<const T>(default_value)) {}
+
+  // the current value, valid as long as the handle is kept; takes the
+  // spinlock of the atomic shared_ptr, hot paths use a Reader
+  Snapshot snapshot() const {
+    return m_snapshot.load(std::memory_order_acquire);
+  }
+  // a copy of the current value, prefer snapshot() for big types
+  T getValue() const { return *snapshot(); }
+  // bumped after every published change
+  uint64_t getVersion() const {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  // listeners run after the value changed, nothing happens when equal
+  // (only known with operator==)
+  void setValue(const T& v) {
+    Snapshot old;
+    Snapshot now = std::make_shared<const T>(v);
+    std::vector<std::shared_ptr<Listener>> listeners;
+    {
+      auto writer = m_writer.lock();
+      old = snapshot();
+      if constexpr (std::equality_comparable<T>) {
+        if (v == *old) {
+          return;
+        }
+      }
+      m_snapshot.store(now, std::memory_order_release);
+      m_version.fetch_add(1, std::memory_order_release);
+      for (const auto& [key, listener] : writer->listeners) {
+        listeners.push_back(listener);
+      }
+    }
+    for (auto& listener : listeners) {
+      if (listener->delivery == ConfigDelivery::SYNC) {
+        listener->cb(*old, *now);
+        continue;
+      }
+      ConfigDispatcher::Post([listener, old, now]() {
+        if (!listener->removed.load(std::memory_order_acquire)) {
+          listener->cb(*old, *now);
+        }
+      });
+    }
+  }
 
-  const T getValue() const { return m_val; }
-  void setValue(const T& v) { m_val = v; }
+  // return the key to delListener() with
+  uint64_t addListener(OnChange cb,
+                       ConfigDelivery delivery = ConfigDelivery::ASYNC) {
+    auto listener = std::make_shared<Listener>(std::move(cb), delivery);
+    auto writer = m_writer.lock();
+    writer->listeners[++writer->lastKey] = std::move(listener);
+    return writer->lastKey;
+  }
+  // a pending asynchronous call is dropped, one already running completes
+  void delListener(uint64_t key) {
+    auto writer = m_writer.lock();
+    auto it = writer->listeners.find(key);
+    if (it != writer->listeners.end()) {
+      it->second->removed.store(true, std::memory_order_release);
+      writer->listeners.erase(it);
+    }
+  }
 
   std::string toString() override {
+    Snapshot value = snapshot();
     try {
-      return boost::lexical_cast<std::string>(m_val);
+      return ConfigToString<T>(*value);
     } catch (std::exception& e) {
       LOG_ERROR(ROOT_LOGGER())
           << "ConfigVar::toString exeception" << e.what()
-          << "convert: " << typeid(m_val).name() << " to string";
+          << "convert: " << typeid(T).name() << " to string";
     }
     return "";
   }
 
   bool fromString(const std::string& val) override {
     try {
-      m_val = boost::lexical_cast<T>(val);
+      setValue(ConfigFromString<T>(val));
+      return true;
     } catch (std::exception& e) {
       LOG_ERROR(ROOT_LOGGER())
           << "ConfigVar::fromString exeception" << e.what()
-          << "convert: " << "string to " << typeid(m_val).name();
+          << "convert: " << "string to " << typeid(T).name();
+    }
+    return false;
+  }
+
+  bool fromNode(const YAML::Node& node) override {
+    try {
+      setValue(ConfigFromNode<T>(node));
+      return true;
+    } catch (std::exception& e) {
+      LOG_ERROR(ROOT_LOGGER())
+          << "ConfigVar::fromNode exeception " << e.what() << " name="
+          << getName() << " convert: yaml to " << typeid(T).name();
     }
     return false;
   }
 
 private:
-  T m_val;
+  // writer side state, its lock also serializes setValue()
+  struct Listener {
+    Listener(OnChange cb, ConfigDelivery delivery)
+        : cb(std::move(cb)), delivery(delivery) {}
+
+    OnChange cb;
+    ConfigDelivery delivery;
+    std::atomic<bool> removed{false};
+  };
+  struct Writer {
+    uint64_t lastKey = 0;
+    std::map<uint64_t, std::shared_ptr<Listener>> listeners;
+  };
+
+  std::atomic<Snapshot> m_snapshot;
+  std::atomic<uint64_t> m_version{0};
+  Mutex<Writer> m_writer{Writer{}};
 };
 
+/**
+ * @brief Registry of the config vars.
+ *
+ * Lookups are lock-free: the names live in an open addressing table read
+ * under a Rcu::ReadGuard, and a var is registered in place, a bigger table
+ * is only built when it gets half full. Vars are never removed, so the
+ * pointer returned by Lookup() can be kept as a pre-resolved handle instead
+ * of looking the name up again on a hot path.
+ */
 class Config {
 public:
-  using ConfigVarMap = std::map<std::string, std::shared_ptr<ConfigVarBase>>;
-
+  // nullptr when the name is unknown or its var holds another type
   template <class T>
-  static std::shared_ptr<ConfigVar<T>> Lookup(const std::string& name) {
-    auto it = s_vars.find(name);
-    if (it == s_vars.end()) {
+  static std::shared_ptr<ConfigVar<T>> Lookup(std::string_view name) {
+    auto var = LookupBase(name);
+    if (!var || var->getTypeTag() != GetConfigTypeTag<T>()) {
       return nullptr;
     }
-
-    // dynamic_pointer_cast is for shared_ptr from child to base.
-    return std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
+    return std::static_pointer_cast<ConfigVar<T>>(var);
   }
 
+  // register name with default_value unless it exists, throw
+  // std::invalid_argument for a bad name or a var of another type
   template <class T>
   static std::shared_ptr<ConfigVar<T>>
-  Lookup(const std::string& name, const T& default_value,
-         const std::string& description = "") {
-    auto tmp = Lookup<T>(name);
-    if (tmp) {
-      LOG_INFO(ROOT_LOGGER()) << "Lookup name=" << name << " exists";
-      return tmp;
+  Lookup(std::string_view name, const T& default_value,
+         std::string_view description = "") {
+    if (!IsValidName(name)) {
+      LOG_ERROR(ROOT_LOGGER()) << "Lookup name invalid" << name;
+      throw std::invalid_argument(std::string{name});
     }
 
-    // validate name
-    if (name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTU"
-                               "VWXYZ._0123456789") != std::string::npos) {
-      LOG_ERROR(ROOT_LOGGER()) << "Lookup name invalid" << name;
-      throw std::invalid_argument(name);
+    auto var = LookupBase(name);
+    if (var) {
+      LOG_INFO(ROOT_LOGGER()) << "Lookup name=" << name << " exists";
+    } else {
+      // the var of a concurrent registration of the same name may win
+      var = Register(std::make_shared<ConfigVar<T>>(
+          std::string{name}, default_value, std::string{description}));
     }
+    if (var->getTypeTag() != GetConfigTypeTag<T>()) {
+      LOG_ERROR(ROOT_LOGGER())
+          << "Lookup name=" << name << " exists with another type";
+      throw std::invalid_argument(std::string{name});
+    }
+    return std::static_pointer_cast<ConfigVar<T>>(var);
+  }
 
-    std::shared_ptr<ConfigVar<T>> var{
-        new ConfigVar<T>{name, default_value, description}};
-    s_vars[name] = var;
+  // set every registered var named by a path of the document, e.g.
+  // "system.port" for system: {port: 80}; other paths are ignored
+  static void LoadFromYaml(const YAML::Node& root);
 
-    return var;
+  // call cb with the dotted path of every map entry below root, parents
+  // first; a key which is not a valid name is skipped with its subtree
+  using MemberCallback =
+      std::function<void(std::string_view name, const YAML::Node& node)>;
+  static void ForEachMember(const YAML::Node& root, const MemberCallback& cb);
+  static std::shared_ptr<ConfigVarBase> LookupBase(std::string_view name);
+  static bool IsValidName(std::string_view name);
+
+private:
+  // insert var unless its name exists, return the registered one
+  static std::shared_ptr<ConfigVarBase>
+  Register(std::shared_ptr<ConfigVarBase> var);
+};
+
+/**
+ * @brief Reload YAML config files when they change, without a restart.
+ *
+ * A thread watches the directory of every file with inotify, so editors
+ * which replace the file are seen too. Events of a file are debounced: it
+ * is reloaded once no event came for debounceMs. A reload parses only that
+ * file, flattens it like Config::LoadFromYaml() and applies only the
+ * registered keys whose value differs from the last load of the file; other
+ * vars keep their snapshot and version. A key removed from the file keeps
+ * its last value.
+ */
+class ConfigWatcher {
+public:
+  static constexpr uint32_t kDefaultDebounceMs = 100;
+
+  explicit ConfigWatcher(uint32_t debounceMs = kDefaultDebounceMs);
+  ~ConfigWatcher();
+
+  // load path, then reload it on every change; false when it can't be
+  // watched, a file which does not parse yet is still watched
+  bool watch(const std::string& path);
+  // what the thread does after a change: return the number of keys
+  // applied, -1 when the file does not parse. Var listeners run on the
+  // calling thread and must not call into the watcher.
+  int reload(const std::string& path);
+
+  uint64_t getReloadCount() const {
+    return m_reloads.load(std::memory_order_relaxed);
   }
 
 private:
-  static ConfigVarMap s_vars;
+  void run();
+
+private:
+  // last loaded text of every registered key of a file
+  using FileValues = std::unordered_map<std::string, std::string>;
+  struct State {
+    std::unordered_map<int, std::string> dirs; // by watch descriptor
+    std::unordered_map<std::string, FileValues> files; // by path
+  };
+
+  uint32_t m_debounceMs;
+  int m_inotifyFd = -1;
+  int m_wakeFd = -1;
+  Mutex<State> m_state{State{}}; // also serializes reloads
+  std::atomic<uint64_t> m_reloads{0};
+  std::atomic<bool> m_stopping{false};
+  std::unique_ptr<Thread> m_thread;
 };
 
 } // namespace cosmic
@@ -1,39 +1,170 @@
 #pragma once
 
+#include "cosmic/clock.h"
 #include "cosmic/process.h"
+#include "cosmic/sync.h"
+#include "cosmic/thread.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
-#include <fstream>
-#include <list>
+#include <deque>
+#include <limits>
 #include <map>
 #include <memory>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+// Call sites below this level are compiled out by LOG_DEBUG ... LOG_FATAL.
+// 1 = DEBUG, 2 = INFO, 3 = WARN, 4 = ERROR, 5 = FATAL
+#ifndef COSMIC_LOG_MIN_LEVEL
+#define COSMIC_LOG_MIN_LEVEL 1
+#endif
+
+// The stream expression is only evaluated when the level is enabled.
 #define LOG_STREAM(logger, level)                                              \
-  cosmic::LogEventTracker{                                                     \
-      std::shared_ptr<cosmic::LogEvent>{                                       \
-          new cosmic::LogEvent{level, __FILE__, __LINE__, 0,                   \
-                               cosmic::GetProcessId(), cosmic::GetFiberId(),   \
-                               std::time(0)},                                  \
-      },                                                                       \
-      logger}                                                                  \
-      .getStream()
+  (static_cast<int>(level) < COSMIC_LOG_MIN_LEVEL ||                           \
+   !(logger).isEnabled(level))                                                 \
+      ? (void)0                                                                \
+      : cosmic::LogVoidify{} & LOG_EVENT_STREAM(logger, level)
+
+#define LOG_EVENT_STREAM(logger, level)                                        \
+  LOG_EVENT_TRACKER(logger, level).getStream()
+
+#define LOG_EVENT_TRACKER(logger, level)                                       \
+  cosmic::LogEventTracker {                                                    \
+    logger, level, __FILE__, __LINE__, cosmic::GetUptimeMs(),                  \
+        cosmic::GetThreadId(), cosmic::GetFiberId(), cosmic::GetCurrentUs()    \
+  }
+
+// Sampled logging, the state lives in a static of the call site. A
+// suppressed line builds no LogEvent, the next emitted line ends with the
+// number of lines suppressed before it. These are statements, not
+// expressions:
+//   LOG_EVERY_N(logger, cosmic::LogLevel::WARN, 1000) << "retry " << err;
+#define LOG_EVERY_N(logger, level, n)                                          \
+  LOG_SAMPLED(logger, level, cosmic::LogEveryN, n)
+#define LOG_FIRST_N(logger, level, n)                                          \
+  LOG_SAMPLED(logger, level, cosmic::LogFirstN, n)
+#define LOG_EVERY_T(logger, level, seconds)                                    \
+  LOG_SAMPLED(logger, level, cosmic::LogEveryT, seconds)
+// token bucket, perSecond lines per second with bursts of perSecond lines
+#define LOG_RATE_LIMITED(logger, level, perSecond)                             \
+  LOG_SAMPLED(logger, level, cosmic::LogRateLimit, perSecond)
 
+#define LOG_SAMPLED(logger, level, State, arg)                                 \
+  for (uint64_t cosmic_log_pass =                                              \
+           (static_cast<int>(level) < COSMIC_LOG_MIN_LEVEL ||                  \
+            !(logger).isEnabled(level))                                        \
+               ? 0                                                             \
+               : LOG_SITE_STATE(State).admit(arg);                             \
+       cosmic_log_pass; cosmic_log_pass = 0)                                   \
+  LOG_EVENT_TRACKER(logger, level).setSuppressed(cosmic_log_pass - 1).getStream()
+
+// every lambda expression is a distinct type, so this is one static per
+// call site
+#define LOG_SITE_STATE(State)                                                  \
+  ([]() -> State& {                                                            \
+    static State s_state;                                                      \
+    return s_state;                                                            \
+  }())
+
+// type check the stream expression but never run it
+#define LOG_NULL_STREAM()                                                      \
+  true ? (void)0 : cosmic::LogVoidify{} & cosmic::LogNullStream{}
+
+#if COSMIC_LOG_MIN_LEVEL <= 1
 #define LOG_DEBUG(logger) LOG_STREAM(logger, cosmic::LogLevel::DEBUG)
+#else
+#define LOG_DEBUG(logger) LOG_NULL_STREAM()
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 2
 #define LOG_INFO(logger) LOG_STREAM(logger, cosmic::LogLevel::INFO)
+#else
+#define LOG_INFO(logger) LOG_NULL_STREAM()
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 3
 #define LOG_WARN(logger) LOG_STREAM(logger, cosmic::LogLevel::WARN)
+#else
+#define LOG_WARN(logger) LOG_NULL_STREAM()
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 4
 #define LOG_ERROR(logger) LOG_STREAM(logger, cosmic::LogLevel::ERROR)
+#else
+#define LOG_ERROR(logger) LOG_NULL_STREAM()
+#endif
+
 #define LOG_FATAL(logger) LOG_STREAM(logger, cosmic::LogLevel::FATAL)
 
+// std::format style: LOG_INFO_FMT(logger, "x={} y={}", x, y). The format
+// string is checked at compile time, {} takes the next argument, {{ and }}
+// are literal braces. Arguments are only evaluated when the level is
+// enabled and are written straight into the event's buffer.
+#define LOG_FMT(logger, level, fmt, ...)                                       \
+  (static_cast<int>(level) < COSMIC_LOG_MIN_LEVEL ||                           \
+   !(logger).isEnabled(level))                                                 \
+      ? (void)0                                                                \
+      : cosmic::LogFormat(LOG_EVENT_STREAM(logger, level), fmt, ##__VA_ARGS__)
+
+// type check the format string and arguments but never run it
+#define LOG_NULL_FMT(fmt, ...)                                                 \
+  true ? (void)0                                                               \
+       : cosmic::LogFormat(cosmic::LogNullStream{}, fmt, ##__VA_ARGS__)
+
+#if COSMIC_LOG_MIN_LEVEL <= 1
+#define LOG_DEBUG_FMT(logger, fmt, ...)                                        \
+  LOG_FMT(logger, cosmic::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG_FMT(logger, fmt, ...) LOG_NULL_FMT(fmt, ##__VA_ARGS__)
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 2
+#define LOG_INFO_FMT(logger, fmt, ...)                                         \
+  LOG_FMT(logger, cosmic::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO_FMT(logger, fmt, ...) LOG_NULL_FMT(fmt, ##__VA_ARGS__)
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 3
+#define LOG_WARN_FMT(logger, fmt, ...)                                         \
+  LOG_FMT(logger, cosmic::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN_FMT(logger, fmt, ...) LOG_NULL_FMT(fmt, ##__VA_ARGS__)
+#endif
+
+#if COSMIC_LOG_MIN_LEVEL <= 4
+#define LOG_ERROR_FMT(logger, fmt, ...)                                        \
+  LOG_FMT(logger, cosmic::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR_FMT(logger, fmt, ...) LOG_NULL_FMT(fmt, ##__VA_ARGS__)
+#endif
+
+#define LOG_FATAL_FMT(logger, fmt, ...)                                        \
+  LOG_FMT(logger, cosmic::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
 #define ROOT_LOGGER() *cosmic::LoggerManager::GetInstance()->getRoot()
 
+namespace YAML {
+class Node;
+}
+
 namespace cosmic {
 class Logger;
 class LogAppender;
+class LogFormatter;
+class AsyncLogWorker;
 
 enum class LogLevel {
   UNKNOWN = 0,
@@ -42,6 +173,188 @@ enum class LogLevel {
   WARN = 3,
   ERROR = 4,
   FATAL = 5,
+  OFF = 6, // threshold only, nothing is logged at this level
+};
+
+const char* stringifyLogLevel(LogLevel level);
+// case insensitive, UNKNOWN when the name is not a level
+LogLevel parseLogLevel(std::string_view name);
+
+/**
+ * @brief Append-only text buffer with inline storage, it only goes to the
+ * heap when a message is longer than kInlineSize. Replaces std::stringstream
+ * for log content, so building a line needs no allocation and no locale.
+ */
+class LogStream {
+public:
+  static constexpr size_t kInlineSize = 512;
+  // heap buffers bigger than this are released by reset()
+  static constexpr size_t kMaxRetainedSize = 64 * 1024;
+
+  LogStream() = default;
+  LogStream(const LogStream& other);
+  LogStream(LogStream&& other) noexcept;
+  LogStream& operator=(const LogStream& other);
+  LogStream& operator=(LogStream&& other) noexcept;
+  ~LogStream() { release(); }
+
+  void append(const char* data, size_t len) {
+    if (m_size + len > m_capacity) {
+      grow(m_size + len);
+    }
+    std::memcpy(m_data + m_size, data, len);
+    m_size += len;
+  }
+
+  // drop the content but keep a moderate heap buffer for the next line
+  void reset();
+
+  const char* data() const { return m_data; }
+  char* data() { return m_data; }
+  size_t size() const { return m_size; }
+  std::string_view view() const { return {m_data, m_size}; }
+  std::string str() const { return {m_data, m_size}; }
+
+  LogStream& operator<<(const char* str) {
+    if (str) {
+      append(str, std::strlen(str));
+    } else {
+      append("(null)", 6);
+    }
+    return *this;
+  }
+  LogStream& operator<<(const std::string& str) {
+    append(str.data(), str.size());
+    return *this;
+  }
+  LogStream& operator<<(std::string_view str) {
+    append(str.data(), str.size());
+    return *this;
+  }
+  LogStream& operator<<(char c) {
+    append(&c, 1);
+    return *this;
+  }
+  LogStream& operator<<(signed char c) { return *this << (char)c; }
+  LogStream& operator<<(unsigned char c) { return *this << (char)c; }
+  // same as std::ostream without std::boolalpha
+  LogStream& operator<<(bool v) { return *this << (v ? '1' : '0'); }
+  LogStream& operator<<(const void* ptr);
+
+  template <class T>
+    requires std::is_integral_v<T>
+  LogStream& operator<<(T v) {
+    // digits10 + 1 digits and a sign, __int128 included
+    char buf[std::numeric_limits<T>::digits10 + 3];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    append(buf, res.ptr - buf);
+    return *this;
+  }
+
+  // same as the default std::ostream output, i.e. %g
+  template <class T>
+    requires std::is_floating_point_v<T>
+  LogStream& operator<<(T v) {
+    char buf[32];
+    auto res =
+        std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, 6);
+    append(buf, res.ptr - buf);
+    return *this;
+  }
+
+  // slow path for user types which only provide an std::ostream operator
+  template <class T>
+    requires(!std::is_arithmetic_v<T> && !std::is_pointer_v<T> &&
+             requires(std::ostream& os, const T& v) { os << v; })
+  LogStream& operator<<(const T& v) {
+    std::ostringstream ss;
+    ss << v;
+    return *this << ss.str();
+  }
+
+private:
+  void grow(size_t need);
+  void release();
+
+private:
+  char* m_data = m_inline;
+  size_t m_size = 0;
+  size_t m_capacity = kInlineSize;
+  char m_inline[kInlineSize];
+};
+
+enum class LogFieldType : uint8_t {
+  STRING,
+  NUMBER, // finite integer or floating point
+  BOOL,
+};
+
+/**
+ * @brief Content of a LogEvent: the message text plus structured key-value
+ * fields, e.g. LOG_INFO(logger).kv("user", id) << "login". Values are
+ * rendered to text when added.
+ *
+ * fields := (u8 type, u16 keyLen, key, u32 valueLen, value)*
+ */
+class LogMessage : public LogStream {
+public:
+  template <class T> LogMessage& kv(std::string_view key, const T& value) {
+    using U = std::decay_t<T>;
+    LogFieldType type = LogFieldType::STRING;
+    if constexpr (std::is_same_v<U, bool>) {
+      type = LogFieldType::BOOL;
+    } else if constexpr (std::is_floating_point_v<U>) {
+      if (std::isfinite(value)) {
+        type = LogFieldType::NUMBER;
+      }
+    } else if constexpr (std::is_integral_v<U> && !std::is_same_v<U, char> &&
+                         !std::is_same_v<U, signed char> &&
+                         !std::is_same_v<U, unsigned char>) {
+      type = LogFieldType::NUMBER;
+    }
+
+    uint16_t keyLen = key.size();
+    uint32_t valueLen = 0;
+    m_fields.append((const char*)&type, 1);
+    m_fields.append((const char*)&keyLen, 2);
+    m_fields.append(key.data(), keyLen);
+    size_t lenPos = m_fields.size();
+    m_fields.append((const char*)&valueLen, 4);
+    if constexpr (std::is_same_v<U, bool>) {
+      m_fields << (value ? "true" : "false");
+    } else {
+      m_fields << value;
+    }
+    valueLen = m_fields.size() - lenPos - 4;
+    std::memcpy(m_fields.data() + lenPos, &valueLen, 4);
+    return *this;
+  }
+
+  bool hasFields() const { return m_fields.size() > 0; }
+  // fn(LogFieldType type, std::string_view key, std::string_view value)
+  template <class F> void forEachField(F&& fn) const {
+    const char* p = m_fields.data();
+    const char* end = p + m_fields.size();
+    while (p < end) {
+      LogFieldType type = (LogFieldType)*p;
+      uint16_t keyLen;
+      uint32_t valueLen;
+      std::memcpy(&keyLen, p + 1, 2);
+      std::string_view key{p + 3, keyLen};
+      p += 3 + keyLen;
+      std::memcpy(&valueLen, p, 4);
+      fn(type, key, std::string_view{p + 4, valueLen});
+      p += 4 + valueLen;
+    }
+  }
+
+  void reset() {
+    LogStream::reset();
+    m_fields.reset();
+  }
+
+private:
+  LogStream m_fields;
 };
 
 /**
@@ -49,76 +362,434 @@ enum class LogLevel {
  */
 class LogEvent {
 public:
-  using ptr = std::shared_ptr<LogEvent>;
+  LogEvent() = default;
+  // timeUs: microseconds since the epoch
   LogEvent(LogLevel level, const char* file, int32_t line, uint32_t uptime,
-           int32_t threadId, uint32_t fiberId, int64_t time);
+           int32_t threadId, uint32_t fiberId, uint64_t timeUs);
+
+  // reuse this event for a new line
+  void reset(LogLevel level, const char* file, int32_t line, uint32_t uptime,
+             int32_t threadId, uint32_t fiberId, uint64_t timeUs);
 
   LogLevel getLevel() const { return m_level; }
   const char* getFile() const { return m_file; }
   int32_t getLine() const { return m_line; }
   uint64_t getThreadId() const { return m_threadId; }
   uint32_t getFiberId() const { return m_fiberId; }
-  uint64_t getTime() const { return m_time; }
+  uint64_t getTime() const { return m_time / 1000000; } // seconds
+  uint64_t getTimeUs() const { return m_time; }
   uint32_t getUptime() const { return m_uptime; }
-  const std::string getContent() const { return m_stream.str(); }
+  std::string_view getContent() const { return m_stream.view(); }
+  const LogMessage& getMessage() const { return m_stream; }
 
-  std::stringstream& getStream() { return m_stream; }
+  LogMessage& getStream() { return m_stream; }
 
 private:
-  LogLevel m_level;
+  LogLevel m_level = LogLevel::UNKNOWN;
   const char* m_file = nullptr; // file name
   int32_t m_line = 0;           // total line number
   uint32_t m_threadId = 0;      // thread id
   uint32_t m_fiberId = 0;       // fiber id
-  uint64_t m_time = 0;          // timestamp
+  uint64_t m_time = 0;          // timestamp in microseconds
   uint32_t m_uptime = 0;        // running time
-  std::stringstream m_stream;   // content
+  LogMessage m_stream;          // content
+};
+
+/**
+ * @brief Swallow everything, for call sites removed by COSMIC_LOG_MIN_LEVEL.
+ */
+struct LogNullStream {
+  template <class T> LogNullStream& operator<<(const T&) { return *this; }
+};
+
+/**
+ * @brief Turn a stream expression into void, so LOG_* macros can be the
+ * branch of a conditional expression. operator& binds looser than <<.
+ */
+struct LogVoidify {
+  void operator&(LogStream&) {}
+  void operator&(const LogNullStream&) {}
+};
+
+// not constexpr, a format string check which reaches it fails to compile
+inline void LogFormatStringError(const char*) {}
+
+template <class T>
+concept LogStreamable = requires(LogStream& out, const T& v) { out << v; };
+
+/**
+ * @brief Format string of LOG_*_FMT, validated when it is constructed from
+ * a literal: the number of {} must match the arguments and every other
+ * brace must be doubled.
+ */
+template <class... Args> class LogFormatString {
+  static_assert((LogStreamable<Args> && ...),
+                "LOG_FMT argument has no LogStream operator<<");
+
+public:
+  template <size_t N>
+  consteval LogFormatString(const char (&fmt)[N]) : m_fmt(fmt, N - 1) {
+    size_t placeholders = 0;
+    for (size_t i = 0; i < m_fmt.size(); ++i) {
+      if (m_fmt[i] == '{') {
+        if (i + 1 < m_fmt.size() && m_fmt[i + 1] == '{') {
+          ++i;
+          m_escaped = true;
+        } else if (i + 1 < m_fmt.size() && m_fmt[i + 1] == '}') {
+          if (placeholders < sizeof...(Args)) {
+            m_holes[placeholders] = i;
+          }
+          ++i;
+          ++placeholders;
+        } else {
+          LogFormatStringError("only {} placeholders are supported");
+        }
+      } else if (m_fmt[i] == '}') {
+        if (i + 1 < m_fmt.size() && m_fmt[i + 1] == '}') {
+          ++i;
+          m_escaped = true;
+        } else {
+          LogFormatStringError("unmatched } in format string");
+        }
+      }
+    }
+    if (placeholders != sizeof...(Args)) {
+      LogFormatStringError("number of {} and arguments differ");
+    }
+  }
+
+  std::string_view get() const { return m_fmt; }
+  // offset of each {}, only meaningful without escaped braces
+  size_t hole(size_t index) const { return m_holes[index]; }
+  bool isEscaped() const { return m_escaped; }
+
+private:
+  std::string_view m_fmt;
+  std::array<uint32_t, sizeof...(Args)> m_holes{};
+  bool m_escaped = false; // has {{ or }}, LogFormat() scans the string
 };
 
+// append fmt up to its first {}, return what follows the {}
+inline std::string_view AppendFormatLiteral(LogStream& out,
+                                            std::string_view fmt) {
+  size_t start = 0;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] != '{' && fmt[i] != '}') {
+      continue;
+    }
+    // the string is validated, a brace is always followed by another one
+    out.append(fmt.data() + start, i - start);
+    if (fmt[i] == '{' && fmt[i + 1] == '}') {
+      return fmt.substr(i + 2);
+    }
+    out.append(fmt.data() + i, 1);
+    start = ++i + 1;
+  }
+  out.append(fmt.data() + start, fmt.size() - start);
+  return {};
+}
+
+// what std::format prints by default: true / false and the shortest
+// round trip form of floating point numbers
+template <class T> void AppendFormatArg(LogStream& out, const T& arg) {
+  if constexpr (std::is_same_v<T, bool>) {
+    out << (arg ? std::string_view{"true"} : std::string_view{"false"});
+  } else if constexpr (std::is_floating_point_v<T>) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), arg);
+    out.append(buf, res.ptr - buf);
+  } else {
+    out << arg;
+  }
+}
+
+template <class... Args>
+void LogFormat(LogStream& out,
+               LogFormatString<std::type_identity_t<Args>...> fmt,
+               const Args&... args) {
+  std::string_view str = fmt.get();
+  if (!fmt.isEscaped()) {
+    // literal pieces have known bounds, no scanning
+    size_t pos = 0;
+    size_t index = 0;
+    ((out.append(str.data() + pos, fmt.hole(index) - pos),
+      pos = fmt.hole(index++) + 2, AppendFormatArg(out, args)),
+     ...);
+    out.append(str.data() + pos, str.size() - pos);
+    return;
+  }
+  std::string_view rest = str;
+  ((rest = AppendFormatLiteral(out, rest), AppendFormatArg(out, args)), ...);
+  AppendFormatLiteral(out, rest);
+}
+
+template <class... Args>
+void LogFormat(const LogNullStream&,
+               LogFormatString<std::type_identity_t<Args>...>,
+               const Args&...) {}
+
 /**
- * @brief Track the lifetime of LogEvent. In order to commit log when LogEvent
- * drop.
+ * @brief Track the lifetime of LogEvent. In order to commit log when the
+ * tracker drop. The event is borrowed from a per thread pool, so a line
+ * costs no allocation; nested logging (e.g. a LOG_* inside an operator<<)
+ * takes the next pool slot and falls back to the heap when it runs out.
  */
 class LogEventTracker {
 public:
-  LogEventTracker(LogEvent::ptr event, const Logger& logger);
+  static constexpr int kMaxNesting = 4;
+
+  LogEventTracker(const Logger& logger, LogLevel level, const char* file,
+                  int32_t line, uint32_t uptime, int32_t threadId,
+                  uint32_t fiberId, uint64_t timeUs);
   ~LogEventTracker();
-  std::stringstream& getStream() { return m_event->getStream(); }
+  LogMessage& getStream() { return m_event->getStream(); }
+  // lines a sampled call site dropped before this one
+  LogEventTracker& setSuppressed(uint64_t count) {
+    m_suppressed = count;
+    return *this;
+  }
+
+private:
+  LogEventTracker(const LogEventTracker&) = delete;
+  LogEventTracker& operator=(const LogEventTracker&) = delete;
 
 private:
-  std::shared_ptr<LogEvent> m_event;
+  LogEvent* m_event;
+  std::unique_ptr<LogEvent> m_owned; // only when the pool is exhausted
   const Logger& m_logger;
+  uint64_t m_suppressed = 0;
+};
+
+/**
+ * @brief Lines suppressed by a call site, spread over cache lines by thread
+ * so a hot suppressed site does not bounce one line between cores.
+ */
+class LogSuppressedCount {
+public:
+  void add() {
+    m_shards[GetThreadId() & (kShards - 1)].count.fetch_add(
+        1, std::memory_order_relaxed);
+  }
+  uint64_t take() {
+    uint64_t total = 0;
+    for (auto& shard : m_shards) {
+      if (shard.count.load(std::memory_order_relaxed) != 0) {
+        total += shard.count.exchange(0, std::memory_order_relaxed);
+      }
+    }
+    return total;
+  }
+
+private:
+  static constexpr size_t kShards = 4;
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> count{0};
+  };
+  Shard m_shards[kShards];
+};
+
+/**
+ * @brief Call site state of the sampled LOG_* macros. admit() returns 0
+ * when the line is suppressed, otherwise 1 + the number of lines suppressed
+ * since the previous one.
+ *
+ * LogEveryN has to count calls, so every call, suppressed or not, is one
+ * fetch_add on the shared counter of the call site. The other states only
+ * read on the suppressed path, plus a thread sharded increment.
+ */
+class LogEveryN {
+public:
+  uint64_t admit(uint64_t n) {
+    uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+    if (n <= 1 || count == 0) {
+      return 1;
+    }
+    return count % n == 0 ? n : 0;
+  }
+
+private:
+  std::atomic<uint64_t> m_count{0};
+};
+
+class LogFirstN {
+public:
+  // once the budget is spent a call is a single relaxed load
+  uint64_t admit(uint64_t n) {
+    if (m_count.load(std::memory_order_relaxed) >= n) {
+      return 0;
+    }
+    return m_count.fetch_add(1, std::memory_order_relaxed) < n ? 1 : 0;
+  }
+
+private:
+  std::atomic<uint64_t> m_count{0};
+};
+
+class LogEveryT {
+public:
+  uint64_t admit(double seconds) {
+    uint64_t now = GetCoarseMonotonicUs();
+    uint64_t next = m_next.load(std::memory_order_relaxed);
+    if (now < next ||
+        !m_next.compare_exchange_strong(next, now + (uint64_t)(seconds * 1e6),
+                                        std::memory_order_relaxed)) {
+      m_suppressed.add();
+      return 0;
+    }
+    return 1 + m_suppressed.take();
+  }
+
+private:
+  std::atomic<uint64_t> m_next{0}; // coarse monotonic us of the next line
+  LogSuppressedCount m_suppressed;
+};
+
+/**
+ * @brief Token bucket as a generic cell rate algorithm: a single atomic
+ * holds the time the bucket becomes full again.
+ */
+class LogRateLimit {
+public:
+  uint64_t admit(double perSecond) {
+    uint64_t interval = perSecond > 0 ? (uint64_t)(1e6 / perSecond) : 0;
+    interval = std::max<uint64_t>(interval, 1);
+    // allow a burst of perSecond lines
+    uint64_t tolerance = interval * (std::max<uint64_t>(perSecond, 1) - 1);
+    uint64_t now = GetCoarseMonotonicUs();
+    uint64_t tat = m_tat.load(std::memory_order_relaxed);
+    for (;;) {
+      if (tat > now + tolerance) {
+        m_suppressed.add();
+        return 0;
+      }
+      if (m_tat.compare_exchange_weak(tat, std::max(tat, now) + interval,
+                                      std::memory_order_relaxed)) {
+        return 1 + m_suppressed.take();
+      }
+    }
+  }
+
+private:
+  std::atomic<uint64_t> m_tat{0}; // theoretical arrival time in coarse us
+  LogSuppressedCount m_suppressed;
 };
 
 /**
  * @brief Manage log output (appender) and commit log.
+ *
+ * In async mode log() only pushes the event into a bounded queue and a
+ * background thread feeds the appenders. When the queue is full the event
+ * is dropped and counted instead of blocking the caller.
+ *
+ * A logger without appenders writes through its parent in the dotted name
+ * hierarchy ("system.net" -> "system" -> "root"), with the parent's level,
+ * appenders and async worker but its own name.
+ *
+ * The appenders are published as an immutable AppenderSet behind an
+ * RcuPtr: changing appenders, their level or formatter builds a new set
+ * and swaps it in, so log() never takes a lock nor sees a partial update.
  */
 class Logger {
 public:
   Logger(const std::string& name = "root");
+  ~Logger();
 
-  void log(LogEvent::ptr event) const;
+  void log(const LogEvent& event) const;
 
   void addAppender(std::shared_ptr<LogAppender> appender);
   void delAppender(std::shared_ptr<LogAppender> appender);
+  // replace every appender in one step
+  void setAppenders(std::vector<std::shared_ptr<LogAppender>> appenders);
+  void clearAppenders() { setAppenders({}); }
+  std::vector<std::shared_ptr<LogAppender>> getAppenders() const;
   const std::string& getName() const { return m_name; }
 
+  // the lowest level accepted by any appender, inherited from the parent
+  // without appenders, OFF when there is no appender up the hierarchy
+  LogLevel getLevel() const { return m_level.load(std::memory_order_relaxed); }
+  bool isEnabled(LogLevel level) const { return level >= getLevel(); }
+  // recompute the level and the appender groups, appenders call it when
+  // their level or formatter changes
+  void refresh();
+
+  const std::shared_ptr<Logger>& getParent() const { return m_parent; }
+
+  // start the background thread, queueDepth is rounded up to power of two;
+  // safe while other threads log, the lines before it stay synchronous
+  void setAsync(size_t queueDepth = 8192);
+  bool isAsync() const {
+    return m_worker.load(std::memory_order_acquire) != nullptr;
+  }
+  // block until every queued event has been written to the appenders,
+  // then flush the appenders
+  void flush() const;
+
+  uint64_t getQueuedCount() const;
+  uint64_t getDroppedCount() const;
+
+private:
+  friend class LoggerManager;
+
+  void setParent(std::shared_ptr<Logger> parent);
+  // follow the parent's appenders and level, recursively for the children
+  void inherit();
+  void dispatch(const Logger& logger, const LogEvent& event) const;
+
+  /**
+   * @brief Appenders with the same pattern, an event is formatted once per
+   * group.
+   */
+  struct AppenderGroup {
+    std::shared_ptr<const LogFormatter> formatter;
+    LogLevel level; // lowest level in the group
+    std::vector<LogAppender*> appenders;
+  };
+
+  /**
+   * @brief What log() reads, never modified once published.
+   */
+  struct AppenderSet {
+    std::vector<std::shared_ptr<LogAppender>> appenders;
+    std::vector<AppenderGroup> groups;
+    std::vector<LogAppender*> unformatted; // appenders without formatter
+    LogLevel level = LogLevel::OFF;        // of these appenders alone
+  };
+
 private:
   std::string m_name; // logger name
-  std::list<std::shared_ptr<LogAppender>> m_appenders;
+  // writer side copy, changes are serialized by its lock
+  mutable Mutex<std::vector<std::shared_ptr<LogAppender>>> m_appenders{
+      std::vector<std::shared_ptr<LogAppender>>{}};
+  RcuPtr<const AppenderSet> m_set{new AppenderSet{}};
+  std::atomic<LogLevel> m_level{LogLevel::OFF};
+  // published once by setAsync(), freed by the destructor only
+  std::atomic<AsyncLogWorker*> m_worker{nullptr};
+
+  std::shared_ptr<Logger> m_parent;
+  Mutex<std::vector<Logger*>> m_children{std::vector<Logger*>{}};
+  // the logger whose appenders write our events, this or an ancestor
+  std::atomic<const Logger*> m_target{this};
 };
 
 /**
  * @brief Format the log pattern.
+ *
+ * The pattern is parsed once into FormatItem objects, used by format(), and
+ * compiled into a flat list of ops, used by formatTo(). formatTo() appends
+ * straight into the caller's buffer and renders %d at most once per second
+ * per thread.
  */
 class LogFormatter {
 public:
   LogFormatter(const std::string& pattern =
                    "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T(%c)%T<%f:%l>%T%m%n");
+  virtual ~LogFormatter() = default;
 
-  std::string format(const Logger& logger, std::shared_ptr<LogEvent> event);
+  virtual std::string format(const Logger& logger, const LogEvent& event);
+  virtual void formatTo(LogStream& out, const Logger& logger,
+                        const LogEvent& event) const;
 
-  const std::string& getPattern() { return m_pattern; }
+  const std::string& getPattern() const { return m_pattern; }
   void setPattern(const std::string& pattern);
 
 private:
@@ -128,36 +799,114 @@ public:
   class FormatItem {
   public:
     virtual void format(std::ostream& os, const Logger& logger,
-                        LogEvent::ptr event) = 0;
+                        const LogEvent& event) = 0;
     virtual ~FormatItem() = default;
   };
 
+protected:
+  enum class OpCode {
+    TEXT,
+    MESSAGE,
+    LEVEL,
+    UPTIME,
+    LOGGER_NAME,
+    THREAD_ID,
+    FIBER_ID,
+    DATETIME,
+    FILENAME,
+    LINE,
+    MILLISECOND,
+    MICROSECOND,
+  };
+
+  struct Op {
+    OpCode code;
+    std::string text; // literal text or strftime format of DATETIME
+    uint64_t id = 0;  // DATETIME cache key, unique per process
+  };
+
+  void appendDateTime(LogStream& out, const Op& op, uint64_t second) const;
+  static uint64_t NextDateTimeId();
+
 private:
   std::string m_pattern;
   std::vector<std::unique_ptr<FormatItem>> m_items;
+  std::vector<Op> m_ops;
+};
+
+/**
+ * @brief Write every event as one JSON object per line:
+ *
+ *   {"time":"2024-05-01T12:00:00.123456","level":"INFO","logger":"root",
+ *    "thread":1,"fiber":0,"file":"a.cc","line":3,"message":"...",
+ *    "user":42}
+ *
+ * Structured fields follow the fixed keys, numbers and booleans unquoted.
+ */
+class JsonLogFormatter : public LogFormatter {
+public:
+  // getPattern() of a JsonLogFormatter, so YAML can ask for one
+  static constexpr const char* kPattern = "json";
+
+  JsonLogFormatter();
+
+  std::string format(const Logger& logger, const LogEvent& event) override;
+  void formatTo(LogStream& out, const Logger& logger,
+                const LogEvent& event) const override;
+
+  // append str as the body of a JSON string, SSE2/AVX2 scan with a scalar
+  // fallback; bytes >= 0x80 are copied as is
+  static void Escape(LogStream& out, std::string_view str);
+
+private:
+  Op m_time;
 };
 
 /**
  * @brief The base class for the sink of log output.
+ *
+ * Logger renders an event once for all appenders sharing a pattern and
+ * passes the bytes to append(). An appender without a formatter gets the
+ * raw event through log() instead.
  */
 class LogAppender {
 public:
   explicit LogAppender(LogLevel level);
   LogAppender(std::unique_ptr<LogFormatter> formatter, LogLevel level);
   virtual ~LogAppender() = default;
-  virtual void log(const Logger& logger, std::shared_ptr<LogEvent> event) = 0;
 
-  void setFormatter(std::unique_ptr<LogFormatter> formatter) {
-    m_formatter = std::move(formatter);
-  }
-  const LogFormatter* getFormatter() const { return m_formatter.get(); }
+  // filter by level, format with our own formatter and append()
+  virtual void log(const Logger& logger, const LogEvent& event);
+  // write an already formatted line, rendered is only valid in this call
+  virtual void append(const LogEvent& event, std::string_view rendered) = 0;
+  // push buffered output to the sink
+  virtual void flush() {}
+
+  // the formatter is replaced, never changed in place, so loggers can
+  // keep using the old one until they regroup
+  void setFormatter(std::unique_ptr<LogFormatter> formatter);
   void setFormatter(const std::string& pattern);
-  LogLevel getLogLevel() const { return m_level; }
-  void setLogLevel(LogLevel level) { m_level = level; }
+  std::shared_ptr<const LogFormatter> getFormatter() const {
+    return m_formatter.load(std::memory_order_acquire);
+  }
+  LogLevel getLogLevel() const {
+    return m_level.load(std::memory_order_relaxed);
+  }
+  void setLogLevel(LogLevel level);
+
+private:
+  friend class Logger;
+  void addOwner(Logger* logger);
+  void delOwner(Logger* logger);
+  void refreshOwners();
 
 protected:
-  std::unique_ptr<LogFormatter> m_formatter;
-  LogLevel m_level;
+  std::atomic<std::shared_ptr<const LogFormatter>> m_formatter;
+  std::atomic<LogLevel> m_level;
+
+private:
+  // loggers using this appender, they regroup when we change
+  Mutex<std::vector<Logger*>> m_owners{std::vector<Logger*>{}};
 };
 
 /**
@@ -168,45 +917,500 @@ public:
   StdoutLogAppender(std::unique_ptr<LogFormatter> formatter, LogLevel level);
   StdoutLogAppender(LogLevel level);
   StdoutLogAppender();
-  virtual void log(const Logger& logger,
-                   std::shared_ptr<LogEvent> event) override;
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+};
+
+/**
+ * @brief Flush policy of FileLogAppender.
+ */
+struct FileLogOptions {
+  size_t flushBytes = 64 * 1024;         // 0 flushes every line
+  uint32_t flushIntervalMs = 1000;       // 0 disables the flush thread
+  LogLevel flushLevel = LogLevel::ERROR; // flush these lines immediately
+  uint32_t syncIntervalMs = 0;           // fdatasync cadence, 0 = never
+
+  uint64_t rotateBytes = 0;       // rotate at this file size, 0 = never
+  uint32_t rotateIntervalSec = 0; // rotate this often, 0 = never
+  uint32_t maxFiles = 0;          // rotated files kept, 0 = keep all
+  bool compress = false;          // gzip rotated files
+
+  // keys: flush_bytes, flush_interval_ms, flush_level, sync_interval_ms,
+  // rotate_bytes, rotate_interval_s, max_files, compress
+  static FileLogOptions FromYaml(const YAML::Node& node);
+  // the keys which differ from the defaults
+  void toYaml(YAML::Node& node) const;
+
+  bool operator==(const FileLogOptions& other) const = default;
 };
 
 /**
  * @brief file log output implementation.
+ *
+ * Lines are collected in userspace chunks and written to a raw fd with one
+ * writev() per flush. A flush happens when the buffered bytes reach
+ * flushBytes, when an event at or above flushLevel arrives, every
+ * flushIntervalMs on a background thread, and on flush() / destruction.
+ *
+ * Rotation runs on the same background thread: the file is renamed to
+ * <filename>.<YYYYmmdd-HHMMSS>, a new file is opened and only then swapped
+ * in, so writers keep appending to the old fd meanwhile and never wait on
+ * rename() or open(). Rotated files are optionally gzipped and pruned; gzip
+ * runs on its own thread so a large file never delays the interval flush.
  */
 class FileLogAppender : public LogAppender {
 public:
+  using Options = FileLogOptions;
+
   FileLogAppender(const std::string& filename,
-                  std::unique_ptr<LogFormatter> formatter, LogLevel level);
+                  std::unique_ptr<LogFormatter> formatter, LogLevel level,
+                  const Options& options = Options{});
 
-  FileLogAppender(const std::string& filename, LogLevel level);
+  FileLogAppender(const std::string& filename, LogLevel level,
+                  const Options& options = Options{});
   FileLogAppender(const std::string& filename);
   ~FileLogAppender();
 
-  virtual void log(const Logger& logger,
-                   std::shared_ptr<LogEvent> event) override;
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+  virtual void flush() override;
 
   bool reopen();
+  const Options& getOptions() const { return m_options; }
+  const std::string& getFilename() const { return m_filename; }
+
+private:
+  void init();
+  void runBackground();
+  bool needRotate();
+  void rotate();
+  void runCompress();
+  void pruneRotated();
+
+  struct Pending {
+    std::vector<std::string> chunks; // filled in order, written by writev
+    std::vector<std::string> spare;  // written chunks kept for reuse
+    size_t bytes = 0;
+  };
+
+  static constexpr size_t kChunkSize = 64 * 1024;
 
 private:
   std::string m_filename;
-  std::ofstream m_filestream;
+  Options m_options;
+  Mutex<Pending> m_pending{Pending{}};
+  Mutex<int> m_fd{-1}; // also orders concurrent flushes
+  uint64_t m_lastSyncUs = 0;
+  uint64_t m_fileBytes = 0; // size of the current file, guarded by m_fd
+  std::atomic<uint64_t> m_openedUs{0};
+  std::atomic<bool> m_rotateRequested{false};
+
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  std::unique_ptr<Thread> m_background;
+
+  Mutex<std::deque<std::string>> m_compressQueue{
+      std::deque<std::string>{}}; // rotated, not gzipped yet
+  std::atomic<bool> m_compressStopping{false}; // set once rotate() is done
+  Semaphore m_compressSignal;
+  std::unique_ptr<Thread> m_compressor;
+};
+
+/**
+ * @brief Log into memory mapped, preallocated segment files.
+ *
+ * Writers reserve space with an atomic fetch_add on the current segment and
+ * memcpy the line into the mapping, there is no lock and no syscall on the
+ * hot path. The writer which overflows a segment switches everybody to the
+ * next one, which a background thread has already created, and the
+ * background thread truncates the full segment to its written length.
+ * Segments are named <basename>.<sequence>.
+ *
+ * When no new segment can be created (ENOSPC, EMFILE...) lines are dropped
+ * and counted until the background thread manages to create one.
+ */
+class MmapFileLogAppender : public LogAppender {
+public:
+  static constexpr size_t kDefaultSegmentSize = 64 * 1024 * 1024;
+
+  MmapFileLogAppender(const std::string& basename,
+                      std::unique_ptr<LogFormatter> formatter, LogLevel level,
+                      size_t segmentSize = kDefaultSegmentSize);
+  MmapFileLogAppender(const std::string& basename, LogLevel level,
+                      size_t segmentSize = kDefaultSegmentSize);
+  MmapFileLogAppender(const std::string& basename);
+  ~MmapFileLogAppender();
+
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+  virtual void flush() override;
+
+  uint64_t getSegmentCount() const {
+    return m_sequence.load(std::memory_order_relaxed);
+  }
+  uint64_t getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Segment {
+    std::string path;
+    int fd = -1;
+    char* base = nullptr;
+    size_t size = 0;
+    std::atomic<size_t> offset{0};    // next reservation, may pass size
+    std::atomic<size_t> committed{0}; // bytes copied by writers
+    std::atomic<size_t> end{0};       // written length once retired
+  };
+
+  void init();
+  Segment* createSegment();
+  Segment* tryCreateSegment(); // nullptr on failure
+  void roll(Segment* full, size_t end);
+  // wait for writers, truncate to the written length and unmap
+  void releaseSegment(Segment* segment, size_t end);
+  // once no writer nor flush() can still hold it, release and free it
+  void closeSegment(Segment* segment, size_t end);
+  void runPreparer();
+
+private:
+  std::string m_basename;
+  size_t m_segmentSize;
+  std::atomic<uint64_t> m_sequence{0};
+
+  std::atomic<Segment*> m_current{nullptr};
+  std::atomic<Segment*> m_next{nullptr}; // prepared in the background
+  // writers and flush() load m_current inside a Rcu::ReadGuard, a retired
+  // segment is unmapped and freed after Rcu::Synchronize() only
+  Mutex<std::vector<std::unique_ptr<Segment>>> m_segments{
+      std::vector<std::unique_ptr<Segment>>{}};
+  Segment m_dropping; // m_current while no segment could be created
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<uint64_t> m_createFailures{0}; // of the current streak
+  Mutex<std::vector<Segment*>> m_retired{std::vector<Segment*>{}};
+
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  std::unique_ptr<Thread> m_preparer;
+};
+
+/**
+ * @brief Batching and reconnect policy of SocketLogAppender.
+ */
+struct SocketLogOptions {
+  size_t batchLines = 64;              // lines per sendmmsg, wakes the sender
+  uint32_t flushIntervalMs = 50;       // send cadence of the background thread
+  size_t maxPendingLines = 16 * 1024;  // lines kept while the peer is slow
+  uint32_t reconnectIntervalMs = 1000; // delay between connect attempts
+
+  // keys: batch_lines, flush_interval_ms, max_pending_lines,
+  // reconnect_interval_ms
+  static SocketLogOptions FromYaml(const YAML::Node& node);
+  // the keys which differ from the defaults
+  void toYaml(YAML::Node& node) const;
+
+  bool operator==(const SocketLogOptions& other) const = default;
 };
 
+/**
+ * @brief Send lines as datagrams to a local collector.
+ *
+ * address is "unix:/path/to/socket", "unix:@abstract" or "udp:host:port",
+ * one line per datagram. append() only copies the line into the pending
+ * batch, a background thread sends batches with one sendmmsg() each, never
+ * waiting on the socket. Lines stay pending while the socket buffer is full
+ * or the peer is gone, and new lines are dropped and counted once
+ * maxPendingLines are pending. A lost connection is retried every
+ * reconnectIntervalMs on the background thread.
+ */
+class SocketLogAppender : public LogAppender {
+public:
+  using Options = SocketLogOptions;
+
+  SocketLogAppender(const std::string& address,
+                    std::unique_ptr<LogFormatter> formatter, LogLevel level,
+                    const Options& options = Options{});
+  SocketLogAppender(const std::string& address, LogLevel level,
+                    const Options& options = Options{});
+  ~SocketLogAppender();
+
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+  // send what is pending without waiting for the background thread
+  virtual void flush() override;
+
+  const Options& getOptions() const { return m_options; }
+  bool isConnected() const {
+    return m_connected.load(std::memory_order_relaxed);
+  }
+  uint64_t getSentCount() const {
+    return m_sent.load(std::memory_order_relaxed);
+  }
+  uint64_t getDroppedCount() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Batch {
+    std::string data;
+    std::vector<std::pair<size_t, size_t>> lines; // offset, length
+    size_t next = 0;                              // first line not sent
+  };
+
+  struct Connection {
+    int fd = -1;
+    Batch sending;         // taken from m_pending, sent in order
+    uint64_t retryUs = 0;  // next connect attempt
+  };
+
+  void connect(Connection& conn);
+  void disconnect(Connection& conn);
+  void runBackground();
+
+private:
+  std::string m_address;
+  Options m_options;
+  Mutex<Batch> m_pending{Batch{}};
+  Mutex<Connection> m_conn{Connection{}}; // also orders concurrent sends
+  std::atomic<bool> m_connected{false};
+  std::atomic<uint64_t> m_sent{0};
+  std::atomic<uint64_t> m_dropped{0};
+
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  std::unique_ptr<Thread> m_background;
+};
+
+/**
+ * @brief What AsyncLogAppender does with a line when its queue is full.
+ */
+enum class LogOverflow {
+  BLOCK,           // wait for the consumer
+  DROP_NEWEST,     // drop the incoming line
+  DROP_OLDEST,     // evict the oldest queued line
+  DROP_BELOW_LEVEL // drop lines below dropLevel early, block for the rest
+};
+
+LogOverflow parseLogOverflow(std::string_view name);
+const char* stringifyLogOverflow(LogOverflow overflow);
+
+/**
+ * @brief Queue of AsyncLogAppender.
+ */
+struct AsyncLogOptions {
+  size_t queueDepth = 8192; // rounded up to power of two
+  LogOverflow overflow = LogOverflow::DROP_NEWEST;
+  // DROP_BELOW_LEVEL: lines below it are dropped once the queue is 3/4 full
+  LogLevel dropLevel = LogLevel::WARN;
+
+  // keys: queue_depth, overflow (block, drop_newest, drop_oldest,
+  // drop_below_level), drop_level
+  static AsyncLogOptions FromYaml(const YAML::Node& node);
+  // the keys which differ from the defaults
+  void toYaml(YAML::Node& node) const;
+
+  bool operator==(const AsyncLogOptions& other) const = default;
+};
+
+/**
+ * @brief Counters of an AsyncLogAppender, to find the slow sink.
+ */
+struct AsyncLogStats {
+  size_t depth = 0; // lines waiting, approximate
+  size_t capacity = 0;
+  uint64_t queued = 0;
+  uint64_t dropped = 0; // rejected or evicted
+  uint64_t written = 0; // passed to the wrapped appender
+  uint64_t blocked = 0;       // appends which had to wait
+  uint64_t avgLatencyUs = 0;  // from append() to the sink
+  uint64_t maxLatencyUs = 0;
+};
+
+/**
+ * @brief Run another appender on its own thread behind a bounded queue.
+ *
+ * Logger hands the formatted line to append(), which copies it into a
+ * queue slot, slots keep their buffers so a steady state does not
+ * allocate. The consumer thread passes lines to the wrapped appender in
+ * order. The wrapper takes the level and formatter of the wrapped
+ * appender when it is built, change them on the wrapper afterwards.
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+  using Options = AsyncLogOptions;
+
+  AsyncLogAppender(std::shared_ptr<LogAppender> appender,
+                   const Options& options = Options{});
+  // drain the queue into the wrapped appender
+  ~AsyncLogAppender();
+
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+  // wait for the lines queued so far, then flush the wrapped appender
+  virtual void flush() override;
+
+  const std::shared_ptr<LogAppender>& getAppender() const {
+    return m_appender;
+  }
+  const Options& getOptions() const { return m_options; }
+  AsyncLogStats getStats() const;
+
+private:
+  /**
+   * @brief Queue slot, moving swaps buffers with the slot instead of
+   * stealing them.
+   */
+  struct Line {
+    LogEvent event; // metadata only, the message is in text
+    std::string text;
+    uint64_t queuedUs = 0;
+
+    Line() = default;
+    Line& operator=(Line&& other) noexcept;
+    Line& operator=(std::pair<const LogEvent*, std::string_view> src);
+  };
+
+  bool push(const LogEvent& event, std::string_view rendered);
+  void pushBlocking(const LogEvent& event, std::string_view rendered);
+  void run();
+
+private:
+  std::shared_ptr<LogAppender> m_appender;
+  Options m_options;
+  MpmcQueue<Line> m_queue;
+  Semaphore m_signal; // one token per queued line
+  Semaphore m_space;  // wakes blocked producers
+  std::atomic<uint32_t> m_waiters{0};
+  std::atomic<bool> m_stopping{false};
+
+  std::atomic<uint64_t> m_queued{0};
+  std::atomic<uint64_t> m_dropped{0};
+  std::atomic<uint64_t> m_written{0};
+  std::atomic<uint64_t> m_evicted{0}; // queued, then dropped by DROP_OLDEST
+  std::atomic<uint64_t> m_blocked{0};
+  std::atomic<uint64_t> m_latencySumUs{0};
+  std::atomic<uint64_t> m_latencyMaxUs{0};
+  std::unique_ptr<Thread> m_thread;
+};
+
+/**
+ * @brief Keep the recent lines of every thread in memory, write them out
+ * only when something fails.
+ *
+ * Each thread owns a ring of the last capacity lines, appending is a few
+ * relaxed stores and no lock nor syscall. A line at or above triggerLevel
+ * dumps the lines not dumped yet of all threads, oldest first, to the
+ * sink and flushes it. InstallSignalHandler() also dumps every recorder on
+ * a fatal signal, without the sink: the lines go with write(2) to the
+ * crash file, no lock taken and nothing allocated. Slots are read under a
+ * seqlock, a line overwritten while it is being dumped is skipped. Lines
+ * longer than kSlotSize are truncated. The ring of an exited thread is
+ * handed to the next new thread.
+ */
+class FlightRecorderLogAppender : public LogAppender {
+public:
+  static constexpr size_t kSlotSize = 512;
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  // capacity: lines kept per thread, rounded up to power of two
+  FlightRecorderLogAppender(std::shared_ptr<LogAppender> sink,
+                            std::unique_ptr<LogFormatter> formatter,
+                            LogLevel level,
+                            LogLevel triggerLevel = LogLevel::ERROR,
+                            size_t capacity = kDefaultCapacity);
+  FlightRecorderLogAppender(std::shared_ptr<LogAppender> sink, LogLevel level,
+                            LogLevel triggerLevel = LogLevel::ERROR,
+                            size_t capacity = kDefaultCapacity);
+  ~FlightRecorderLogAppender();
+
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+  virtual void flush() override { m_sink->flush(); }
+
+  // write the lines recorded since the last dump to the sink
+  void dump();
+  uint64_t getDumpedCount() const {
+    return m_dumpedLines.load(std::memory_order_relaxed);
+  }
+
+  // dump all recorders on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT, then
+  // re-raise with the previous handler
+  static void InstallSignalHandler();
+  // where a fatal signal dumps to, the file of the sink by default when it
+  // is a FileLogAppender; call it before logging starts
+  void setCrashFile(const std::string& path);
+
+private:
+  friend struct FlightRecorderRings;
+  struct Slot;
+  struct Ring;
+  struct Line;
+
+  Ring* getRing();
+  void dumpLocked();
+  void dumpOnSignal();
+  static void OnFatalSignal(int sig);
+
+private:
+  std::shared_ptr<LogAppender> m_sink;
+  LogLevel m_triggerLevel;
+  size_t m_capacity;
+  uint64_t m_id; // never reused, keys the per-thread ring cache
+
+  // rings of all threads, pushed at the head and only freed with us
+  std::atomic<Ring*> m_rings{nullptr};
+  Mutex<std::vector<std::shared_ptr<Ring>>> m_owned{
+      std::vector<std::shared_ptr<Ring>>{}};
+  Mutex<int> m_dumping{0}; // serializes dumps outside signal handlers
+  std::atomic<bool> m_dumpBusy{false}; // a signal does not dump meanwhile
+  std::atomic<uint64_t> m_dumpedLines{0};
+  std::string m_crashFile; // opened by the signal handler
+  int m_crashFd = -1;      // used when opening fails
+};
+
+/**
+ * @brief Registry of named loggers, safe to use from any thread.
+ *
+ * Lookups probe an open addressing table without taking a lock. Inserts
+ * are serialized by a mutex and publish a bigger copy of the table when it
+ * gets half full; replaced tables are kept until the manager goes away, so
+ * a concurrent reader never touches freed memory. Loggers are never
+ * removed.
+ */
 class LoggerManager {
 public:
-  static std::shared_ptr<LoggerManager> GetInstance();
-  std::shared_ptr<Logger> getLogger(const std::string& name);
-  std::shared_ptr<Logger> getRoot() { return m_root; }
+  ~LoggerManager();
+
+  static const std::shared_ptr<LoggerManager>& GetInstance();
+  // create the logger and its missing ancestors on first use
+  std::shared_ptr<Logger> getLogger(std::string_view name);
+  const std::shared_ptr<Logger>& getRoot() const { return m_root; }
 
 private:
   LoggerManager();
 
+  struct Table {
+    explicit Table(size_t size) : mask(size - 1), slots(new Slot[size]) {}
+
+    using Slot = std::atomic<const std::shared_ptr<Logger>*>;
+    size_t mask;
+    size_t used = 0; // only changed with m_registry locked
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  struct Registry {
+    std::vector<std::unique_ptr<std::shared_ptr<Logger>>> loggers;
+    std::vector<std::unique_ptr<Table>> tables; // current one is last
+  };
+
+  const std::shared_ptr<Logger>* find(std::string_view name) const;
+  const std::shared_ptr<Logger>& create(Registry& registry,
+                                        std::string_view name);
+  void insert(Registry& registry, const std::shared_ptr<Logger>* logger);
+
 private:
-  std::map<std::string, std::shared_ptr<Logger>> m_loggers;
   std::shared_ptr<Logger> m_root;
-
-  static std::shared_ptr<LoggerManager> s_instance;
+  std::atomic<Table*> m_table{nullptr};
+  Mutex<Registry> m_registry{Registry{}};
 };
 } // namespace cosmic
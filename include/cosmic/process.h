@@ -5,8 +5,10 @@
 
 namespace cosmic {
 
+// cached, refreshed in the child of fork()
 pid_t GetProcessId();
 
+// cached per thread, no syscall after the first call
 pid_t GetThreadId();
 
 uint32_t GetFiberId();
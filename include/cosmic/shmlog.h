@@ -0,0 +1,186 @@
+#pragma once
+
+#include "cosmic/log.h"
+#include "cosmic/sync.h"
+#include "cosmic/thread.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cosmic {
+
+/**
+ * @brief Layout of the shared memory ring, the same in every process.
+ *
+ *   region := header[kHeaderSize] slot[slotCount]
+ *   slot   := seq, level, len, timeUs, data[slotSize - kSlotHeader]
+ *
+ * Slots follow D. Vyukov's bounded queue: seq == pos means free for the
+ * producer claiming pos, seq == pos + 1 means committed, the collector
+ * frees it for the next lap with seq = pos + slotCount. A producer claims
+ * pos by a CAS on tail, then reserves the slot by a CAS of seq from pos to
+ * Writing(pid) before it writes anything, so a slot the collector took
+ * back meanwhile is never written.
+ */
+namespace shmlog {
+constexpr uint64_t kMagic = 0x32474f4c4d4d4853; // "SHMMLOG2"
+constexpr size_t kHeaderSize = 64;
+constexpr size_t kSlotHeader = 32;
+constexpr uint64_t kWritingBit = 1ull << 63;
+
+// seq of a slot being written by pid
+constexpr uint64_t Writing(pid_t pid) { return kWritingBit | (uint32_t)pid; }
+
+struct Header {
+  uint64_t magic;
+  uint64_t slotCount; // power of two
+  uint64_t slotSize;  // header included, multiple of 8
+  std::atomic<uint64_t> tail{0}; // next position to claim
+  std::atomic<uint64_t> head{0}; // next position to collect
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> abandoned{0}; // slots of crashed producers
+};
+
+struct Slot {
+  std::atomic<uint64_t> seq;
+  uint32_t reserved0;
+  uint8_t level;
+  uint8_t reserved[3];
+  uint32_t len;
+  uint32_t reserved2;
+  uint64_t timeUs;
+  // the line follows, up to slotSize - kSlotHeader bytes
+};
+static_assert(sizeof(Header) <= kHeaderSize);
+static_assert(sizeof(Slot) == kSlotHeader);
+} // namespace shmlog
+
+/**
+ * @brief Multi-process ring of formatted lines in shared memory.
+ *
+ * Producers in any process push() lines with two CASes and a memcpy, the
+ * only collector drains them in claim order. A producer which dies while
+ * writing a slot leaves it reserved with its pid; the collector skips such
+ * a slot once that process is gone. One which dies between claiming and
+ * reserving leaves no pid, the collector skips the slot after kOrphanMs;
+ * if the producer was only stopped, its reservation then fails and the
+ * line is dropped. So one crash never stalls nor corrupts the ring. Lines
+ * longer than a slot are truncated.
+ */
+class SharedLogRing {
+public:
+  static constexpr size_t kDefaultSlotCount = 64 * 1024;
+  static constexpr size_t kDefaultSlotSize = 512;
+  static constexpr uint64_t kOrphanMs = 5000;
+
+  ~SharedLogRing();
+
+  // name empty: an anonymous memfd, shared with children forked after
+  // this call; otherwise a shm_open() object others can Open()
+  static std::shared_ptr<SharedLogRing>
+  Create(const std::string& name = "", size_t slotCount = kDefaultSlotCount,
+         size_t slotSize = kDefaultSlotSize);
+  // nullptr when the object does not exist or is not a ring
+  static std::shared_ptr<SharedLogRing> Open(const std::string& name);
+  // remove the shm_open() name, mappings stay valid
+  static void Unlink(const std::string& name);
+
+  // false when the ring is full, the line is counted as dropped
+  bool push(LogLevel level, uint64_t timeUs, std::string_view line);
+
+  // collector only: hand committed lines to cb in order, return how many
+  using Callback = std::function<void(LogLevel, uint64_t, std::string_view)>;
+  size_t drain(const Callback& cb);
+
+  size_t getSlotCount() const { return m_header->slotCount; }
+  size_t getMaxLine() const {
+    return m_header->slotSize - shmlog::kSlotHeader;
+  }
+  uint64_t getDroppedCount() const {
+    return m_header->dropped.load(std::memory_order_relaxed);
+  }
+  uint64_t getAbandonedCount() const {
+    return m_header->abandoned.load(std::memory_order_relaxed);
+  }
+  int getFd() const { return m_fd; }
+
+private:
+  SharedLogRing(int fd, void* base, size_t size);
+
+  shmlog::Slot* slot(uint64_t pos) const {
+    return (shmlog::Slot*)(m_slots +
+                           (pos & (m_header->slotCount - 1)) *
+                               m_header->slotSize);
+  }
+  // true when the claimed slot at pos, seq still pos, was not reserved
+  // for kOrphanMs
+  bool isOrphaned(uint64_t pos);
+
+private:
+  int m_fd;
+  void* m_base;
+  size_t m_size;
+  shmlog::Header* m_header;
+  char* m_slots;
+
+  // collector state: since when the slot at head is stuck unreserved
+  uint64_t m_stuckPos = ~0ull;
+  uint64_t m_stuckSinceUs = 0;
+};
+
+/**
+ * @brief Producer side, a worker process logs into the shared ring.
+ */
+class SharedLogAppender : public LogAppender {
+public:
+  SharedLogAppender(std::shared_ptr<SharedLogRing> ring,
+                    std::unique_ptr<LogFormatter> formatter, LogLevel level);
+  SharedLogAppender(std::shared_ptr<SharedLogRing> ring, LogLevel level);
+
+  virtual void append(const LogEvent& event,
+                      std::string_view rendered) override;
+
+  const std::shared_ptr<SharedLogRing>& getRing() const { return m_ring; }
+
+private:
+  std::shared_ptr<SharedLogRing> m_ring;
+};
+
+/**
+ * @brief Drain a shared ring into appenders on a background thread, the
+ * only writer of the real log files.
+ */
+class SharedLogCollector {
+public:
+  SharedLogCollector(std::shared_ptr<SharedLogRing> ring,
+                     std::vector<std::shared_ptr<LogAppender>> appenders,
+                     uint32_t pollIntervalMs = 10);
+  // drain what is left, then flush the appenders
+  ~SharedLogCollector();
+
+  // drain now on the calling thread, serialized with the background one
+  size_t drain();
+  uint64_t getCollectedCount() const {
+    return m_collected.load(std::memory_order_relaxed);
+  }
+
+private:
+  void run();
+
+private:
+  std::shared_ptr<SharedLogRing> m_ring;
+  std::vector<std::shared_ptr<LogAppender>> m_appenders;
+  uint32_t m_pollIntervalMs;
+  Mutex<LogEvent> m_event{LogEvent{}}; // also serializes drain()
+  std::atomic<uint64_t> m_collected{0};
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_signal;
+  std::unique_ptr<Thread> m_thread;
+};
+
+} // namespace cosmic
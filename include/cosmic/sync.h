@@ -1,11 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <memory>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdexcept>
+#include <utility>
 
 namespace cosmic {
 
@@ -15,6 +19,8 @@ public:
   ~Semaphore();
 
   void wait();
+  // return false when timeout elapsed before a notify
+  bool waitFor(uint64_t ms);
   void notify();
 
 private:
@@ -61,7 +67,8 @@ private:
 template <class T> class Mutex {
 public:
   Mutex(T data)
-      : m_inner(std::unique_ptr<MutexInner<T>>{new MutexInner<T>{data}}) {}
+      : m_inner(std::unique_ptr<MutexInner<T>>{
+            new MutexInner<T>{std::move(data)}}) {}
   ~Mutex() {}
 
   MutexGuard<T> lock() { return MutexGuard<T>{*m_inner}; }
@@ -70,4 +77,158 @@ private:
   std::unique_ptr<MutexInner<T>> m_inner;
 };
 
+/**
+ * @brief Epoch based protection of read-mostly shared objects (a small
+ * RCU).
+ *
+ * Entering a reader section is a store and a fence on a per-thread record,
+ * it never blocks. Writers publish a new object, then either Synchronize()
+ * waits until every reader which may still hold the old one has left its
+ * section, or Retire() hands the old one to a background thread which
+ * frees it once they have. Synchronize() waits on every reader section of
+ * the process, a slow appender included, so writer paths use Retire().
+ * Synchronize() must not be called from inside a reader section.
+ */
+class Rcu {
+public:
+  class ReadGuard {
+  public:
+    ReadGuard() { Rcu::Enter(); }
+    ~ReadGuard() { Rcu::Leave(); }
+
+  private:
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+  };
+
+  // reader sections nest
+  static void Enter();
+  static void Leave();
+  static void Synchronize();
+  // run free once no current reader section remains, never blocks
+  static void Retire(std::function<void()> free);
+};
+
+/**
+ * @brief Pointer published with Rcu, load() is only valid inside a
+ * Rcu::ReadGuard.
+ */
+template <class T> class RcuPtr {
+public:
+  explicit RcuPtr(T* ptr = nullptr) : m_ptr(ptr) {}
+  ~RcuPtr() { delete m_ptr.load(std::memory_order_relaxed); }
+
+  T* load() const { return m_ptr.load(std::memory_order_acquire); }
+
+  // publish ptr, the old object is deleted once no reader can see it
+  void reset(T* ptr) {
+    T* old = m_ptr.exchange(ptr, std::memory_order_seq_cst);
+    if (old) {
+      Rcu::Retire([old]() { delete old; });
+    }
+  }
+
+private:
+  RcuPtr(const RcuPtr&) = delete;
+  RcuPtr& operator=(const RcuPtr&) = delete;
+
+private:
+  std::atomic<T*> m_ptr;
+};
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * Every slot carries a sequence number which tells producers and consumers
+ * whether the slot is free for the current lap of the ring (D. Vyukov's
+ * bounded MPMC queue). Capacity is rounded up to a power of two.
+ */
+template <class T> class MpmcQueue {
+public:
+  explicit MpmcQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    m_mask = size - 1;
+    m_slots = std::unique_ptr<Slot[]>{new Slot[size]};
+    for (size_t i = 0; i < size; ++i) {
+      m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // return false when the queue is full
+  template <class U> bool tryPush(U&& value) {
+    Slot* slot;
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+      slot = &m_slots[pos & m_mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::forward<U>(value);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // return false when the queue is empty
+  bool tryPop(T& value) {
+    Slot* slot;
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    for (;;) {
+      slot = &m_slots[pos & m_mask];
+      size_t seq = slot->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (m_head.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_head.load(std::memory_order_relaxed);
+      }
+    }
+    value = std::move(slot->value);
+    slot->seq.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const { return m_mask + 1; }
+
+  // approximate while producers or consumers are running
+  size_t size() const {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+private:
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  struct Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  static constexpr size_t kCacheLine = 64;
+
+  size_t m_mask = 0;
+  std::unique_ptr<Slot[]> m_slots;
+  alignas(kCacheLine) std::atomic<size_t> m_tail{0}; // producer position
+  alignas(kCacheLine) std::atomic<size_t> m_head{0}; // consumer position
+};
+
 } // namespace cosmic
@@ -0,0 +1,284 @@
+#include "cosmic.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// usage: bench_config [ops] [--threads 1,4,16] [--vars n] [--keys n]
+//                     [--filter name] [--json file]
+//
+// First the startup cost: parse and apply a document of `keys` registered
+// vars of mixed types. Then every read case runs once per thread count with
+// `ops` reads per thread over `vars` registered vars. Results go to stdout
+// as a table, and with --json as one JSON object per line, so runs of two
+// commits can be diffed.
+
+/**
+ * @brief One case: make() builds the op of a thread, op(i) reads one var
+ * and is called from several threads at once.
+ */
+struct BenchCase {
+  std::string name;
+  std::function<std::function<uint64_t(uint64_t)>()> make; // per thread
+};
+
+struct BenchResult {
+  std::string name;
+  int threads;
+  uint64_t ops;
+  double opsPerSec;
+  double nsPerOp;
+};
+
+static std::vector<std::string> s_names;
+static std::vector<cosmic::ConfigVar<int>::ptr> s_vars;
+
+static void RegisterVars(size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    s_names.push_back("bench.var_" + std::to_string(i));
+    s_vars.push_back(cosmic::Config::Lookup(s_names.back(), (int)i));
+  }
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
+
+// keys of `keys` sections of up to 100 vars: int, double, bool, string and
+// a list of ints in turn
+static std::string MakeDocument(size_t keys, int round) {
+  std::string doc;
+  for (size_t i = 0; i < keys; i++) {
+    if (i % 100 == 0) {
+      doc += "load_" + std::to_string(i / 100) + ":\n";
+    }
+    doc += "  k" + std::to_string(i % 100) + ": ";
+    std::string n = std::to_string(i + round);
+    switch (i % 5) {
+    case 0: doc += n; break;
+    case 1: doc += n + ".25"; break;
+    case 2: doc += (i + round) % 2 ? "true" : "false"; break;
+    case 3: doc += "value_" + n; break;
+    case 4: doc += "[" + n + ", " + n + ", " + n + "]"; break;
+    }
+    doc += "\n";
+  }
+  return doc;
+}
+
+static void RunLoad(size_t keys, std::ostream* json) {
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < keys; i++) {
+    std::string name = "load_" + std::to_string(i / 100) + ".k" +
+                       std::to_string(i % 100);
+    switch (i % 5) {
+    case 0: cosmic::Config::Lookup(name, 0); break;
+    case 1: cosmic::Config::Lookup(name, 0.0); break;
+    case 2: cosmic::Config::Lookup(name, false); break;
+    case 3: cosmic::Config::Lookup(name, std::string{}); break;
+    case 4: cosmic::Config::Lookup(name, std::vector<int>{}); break;
+    }
+  }
+  double registerMs = ElapsedMs(begin);
+
+  std::string doc = MakeDocument(keys, 1);
+  begin = std::chrono::steady_clock::now();
+  YAML::Node root = YAML::Load(doc);
+  double parseMs = ElapsedMs(begin);
+
+  begin = std::chrono::steady_clock::now();
+  cosmic::Config::LoadFromYaml(root);
+  double applyMs = ElapsedMs(begin);
+
+  // nothing changes, only the lookups and conversions remain
+  begin = std::chrono::steady_clock::now();
+  cosmic::Config::LoadFromYaml(root);
+  double reapplyMs = ElapsedMs(begin);
+
+  std::cout << std::left << std::setw(16) << "load" << std::right
+            << std::setw(8) << "keys" << std::setw(12) << "register"
+            << std::setw(10) << "parse" << std::setw(10) << "apply"
+            << std::setw(10) << "reapply" << std::setw(10) << "total"
+            << std::endl;
+  std::cout << std::left << std::setw(16) << "load (ms)" << std::right
+            << std::setw(8) << keys << std::fixed << std::setprecision(2)
+            << std::setw(12) << registerMs << std::setw(10) << parseMs
+            << std::setw(10) << applyMs << std::setw(10) << reapplyMs
+            << std::setw(10) << registerMs + parseMs + applyMs << std::endl
+            << std::endl;
+  if (json) {
+    *json << "{\"case\":\"load\",\"keys\":" << keys << std::fixed
+          << std::setprecision(3) << ",\"register_ms\":" << registerMs
+          << ",\"parse_ms\":" << parseMs << ",\"apply_ms\":" << applyMs
+          << ",\"reapply_ms\":" << reapplyMs << "}" << std::endl;
+  }
+}
+
+static std::vector<BenchCase> MakeCases() {
+  std::vector<BenchCase> cases;
+  // the name is resolved on every read
+  cases.push_back({"lookup", []() {
+                     return [](uint64_t i) -> uint64_t {
+                       const std::string& name = s_names[i % s_names.size()];
+                       return cosmic::Config::Lookup<int>(name)->getValue();
+                     };
+                   }});
+  cases.push_back({"lookup_miss", []() {
+                     return [](uint64_t i) -> uint64_t {
+                       return cosmic::Config::Lookup<int>("bench.none") ? i
+                                                                        : 0;
+                     };
+                   }});
+  // pre-resolved handles
+  cases.push_back({"handle/get", []() {
+                     return [](uint64_t i) -> uint64_t {
+                       return s_vars[i % s_vars.size()]->getValue();
+                     };
+                   }});
+  cases.push_back({"handle/reader", []() {
+                     auto readers = std::make_shared<
+                         std::vector<cosmic::ConfigVar<int>::Reader>>();
+                     for (const auto& var : s_vars) {
+                       readers->emplace_back(*var);
+                     }
+                     return [readers](uint64_t i) -> uint64_t {
+                       return (*readers)[i % readers->size()].get();
+                     };
+                   }});
+  return cases;
+}
+
+static BenchResult RunCase(const BenchCase& c, int threads, uint64_t ops) {
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<uint64_t> sink{0};
+
+  auto reader = [&]() {
+    auto op = c.make();
+    ready.fetch_add(1);
+    while (!go.load(std::memory_order_acquire)) {
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+      sum += op(i);
+    }
+    sink.fetch_add(sum);
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back(reader);
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  auto begin = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+
+  BenchResult result;
+  result.name = c.name;
+  result.threads = threads;
+  result.ops = ops * threads;
+  result.opsPerSec = result.ops * 1e9 / wall;
+  // wall time of one thread per read
+  result.nsPerOp = (double)wall / ops;
+  return result;
+}
+
+static void PrintHeader() {
+  std::cout << std::left << std::setw(16) << "case" << std::right
+            << std::setw(8) << "threads" << std::setw(16) << "lookups/s"
+            << std::setw(10) << "ns/op" << std::endl;
+}
+
+static void PrintResult(const BenchResult& r) {
+  std::cout << std::left << std::setw(16) << r.name << std::right
+            << std::setw(8) << r.threads << std::setw(16) << std::fixed
+            << std::setprecision(0) << r.opsPerSec << std::setw(10)
+            << std::setprecision(1) << r.nsPerOp << std::endl;
+}
+
+static void WriteJson(std::ostream& os, const BenchResult& r) {
+  os << "{\"case\":\"" << r.name << "\",\"threads\":" << r.threads
+     << ",\"ops\":" << r.ops << std::fixed << std::setprecision(1)
+     << ",\"ops_per_sec\":" << r.opsPerSec << ",\"ns_per_op\":" << r.nsPerOp
+     << "}" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  uint64_t ops = 2000000;
+  size_t vars = 1000;
+  size_t keys = 10000;
+  std::vector<int> threadCounts = {1, 2, 4, 8, 16};
+  std::string filter;
+  std::string jsonPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      threadCounts.clear();
+      std::string list = argv[++i];
+      for (size_t pos = 0; pos < list.size();) {
+        size_t comma = list.find(',', pos);
+        threadCounts.push_back(std::atoi(list.substr(pos, comma).c_str()));
+        pos = comma == std::string::npos ? list.size() : comma + 1;
+      }
+    } else if (arg == "--vars" && i + 1 < argc) {
+      vars = std::max(std::strtoull(argv[++i], nullptr, 10), 1ull);
+    } else if (arg == "--keys" && i + 1 < argc) {
+      keys = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else {
+      ops = std::strtoull(arg.c_str(), nullptr, 10);
+    }
+  }
+
+  std::ofstream json;
+  if (!jsonPath.empty()) {
+    json.open(jsonPath);
+  }
+
+  if (keys > 0 && (filter.empty() || filter == "load")) {
+    RunLoad(keys, json.is_open() ? &json : nullptr);
+  }
+  RegisterVars(vars);
+
+  PrintHeader();
+  for (const auto& c : MakeCases()) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    for (int threads : threadCounts) {
+      if (threads < 1) {
+        continue;
+      }
+      BenchResult result = RunCase(c, threads, ops);
+      PrintResult(result);
+      if (json.is_open()) {
+        WriteJson(json, result);
+      }
+    }
+  }
+  return 0;
+}
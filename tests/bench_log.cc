@@ -0,0 +1,475 @@
+#include "cosmic.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// usage: bench_log [lines] [--threads 1,4,16] [--filter name] [--json file]
+//
+// Every case runs once per thread count with `lines` lines split between
+// the producers. Results go to stdout as a table, and with --json as one
+// JSON object per line, so runs of two commits can be diffed.
+
+// heap allocations made by the current thread
+static thread_local uint64_t t_allocs = 0;
+
+void* operator new(size_t size) {
+  ++t_allocs;
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+/**
+ * @brief Appender which drops the formatted line, so the numbers show the
+ * cost of building, formatting and dispatching an event.
+ */
+class NullLogAppender : public cosmic::LogAppender {
+public:
+  explicit NullLogAppender(cosmic::LogLevel level = cosmic::LogLevel::DEBUG)
+      : LogAppender(level) {}
+  NullLogAppender(std::unique_ptr<cosmic::LogFormatter> formatter)
+      : LogAppender(std::move(formatter), cosmic::LogLevel::DEBUG) {}
+  void append(const cosmic::LogEvent&, std::string_view) override {}
+};
+
+/**
+ * @brief One run of a case: op() writes a line and may be called from
+ * several threads, finish() waits for asynchronous output and is timed.
+ */
+struct Bench {
+  std::function<void(int)> op;
+  std::function<void()> finish = []() {};
+  std::function<uint64_t()> dropped = []() { return 0; };
+  std::shared_ptr<void> state; // released after the run
+};
+
+struct BenchCase {
+  std::string name;
+  std::function<Bench(const std::string& dir)> make;
+  bool threaded = true;
+};
+
+struct BenchResult {
+  std::string name;
+  int threads;
+  uint64_t lines;
+  double linesPerSec;
+  double nsPerOp;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  double allocsPerLine;
+  uint64_t dropped;
+};
+
+// the line every logger case writes
+#define BENCH_LINE(logger, i)                                                  \
+  LOG_INFO(logger) << "request id=" << (i) << " took " << 0.25 * (i)          \
+                   << " ms path=" << "/index.html"
+
+static Bench LoggerBench(std::vector<std::shared_ptr<cosmic::LogAppender>>
+                             appenders,
+                         bool async = false) {
+  auto logger = std::make_shared<cosmic::Logger>("bench");
+  for (auto& appender : appenders) {
+    logger->addAppender(appender);
+  }
+  if (async) {
+    logger->setAsync(64 * 1024);
+  }
+  Bench bench;
+  bench.op = [logger = logger.get()](int i) { BENCH_LINE(*logger, i); };
+  bench.finish = [logger = logger.get()]() { logger->flush(); };
+  bench.dropped = [logger = logger.get()]() {
+    return logger->getDroppedCount();
+  };
+  bench.state = logger;
+  return bench;
+}
+
+/**
+ * @brief Point fd 1 at /dev/null while alive, for the stdout case.
+ */
+class StdoutToDevNull {
+public:
+  StdoutToDevNull() {
+    std::cout.flush();
+    m_saved = dup(STDOUT_FILENO);
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+  }
+  ~StdoutToDevNull() {
+    std::cout.flush();
+    dup2(m_saved, STDOUT_FILENO);
+    close(m_saved);
+  }
+
+private:
+  int m_saved;
+};
+
+static std::vector<BenchCase> MakeCases() {
+  using namespace cosmic;
+  std::vector<BenchCase> cases;
+
+  cases.push_back({"disabled", [](const std::string&) {
+                     Bench bench = LoggerBench(
+                         {std::make_shared<NullLogAppender>(LogLevel::INFO)});
+                     auto logger = (Logger*)bench.state.get();
+                     bench.op = [logger](int i) {
+                       LOG_DEBUG(*logger) << "request id=" << i;
+                     };
+                     return bench;
+                   }});
+
+  // formatting cost of each pattern, nothing is written
+  std::vector<std::pair<std::string, std::string>> patterns = {
+      {"default", ""},
+      {"message", "%m%n"},
+      {"full", "%d{%Y-%m-%d %H:%M:%S}.%u %p %c %t %F %f:%l %m%n"},
+      {"json", JsonLogFormatter::kPattern},
+  };
+  for (const auto& [name, pattern] : patterns) {
+    cases.push_back({"null/" + name, [pattern](const std::string&) {
+                       std::unique_ptr<LogFormatter> formatter;
+                       if (pattern == JsonLogFormatter::kPattern) {
+                         formatter = std::make_unique<JsonLogFormatter>();
+                       } else if (pattern.empty()) {
+                         formatter = std::make_unique<LogFormatter>();
+                       } else {
+                         formatter = std::make_unique<LogFormatter>(pattern);
+                       }
+                       return LoggerBench({std::make_shared<NullLogAppender>(
+                           std::move(formatter))});
+                     }});
+  }
+
+  // the same line through LOG_INFO_FMT, against null/message
+  cases.push_back({"null/message/fmt", [](const std::string&) {
+                     Bench bench = LoggerBench({std::make_shared<NullLogAppender>(
+                         std::make_unique<LogFormatter>("%m%n"))});
+                     auto logger = (Logger*)bench.state.get();
+                     bench.op = [logger](int i) {
+                       LOG_INFO_FMT(*logger, "request id={} took {} ms path={}",
+                                    i, 0.25 * i, "/index.html");
+                     };
+                     return bench;
+                   }});
+
+  cases.push_back({"disabled/fmt", [](const std::string&) {
+                     Bench bench = LoggerBench(
+                         {std::make_shared<NullLogAppender>(LogLevel::INFO)});
+                     auto logger = (Logger*)bench.state.get();
+                     bench.op = [logger](int i) {
+                       LOG_DEBUG_FMT(*logger, "request id={}", i);
+                     };
+                     return bench;
+                   }});
+
+  cases.push_back({"null/shared_pattern", [](const std::string&) {
+                     return LoggerBench({std::make_shared<NullLogAppender>(),
+                                         std::make_shared<NullLogAppender>()});
+                   }});
+
+  cases.push_back({"stdout", [](const std::string&) {
+                     auto redirect = std::make_shared<StdoutToDevNull>();
+                     Bench bench =
+                         LoggerBench({std::make_shared<StdoutLogAppender>()});
+                     // the logger goes first, then stdout is restored
+                     auto logger = bench.state;
+                     bench.state = std::make_shared<
+                         std::pair<std::shared_ptr<void>,
+                                   std::shared_ptr<void>>>(redirect, logger);
+                     return bench;
+                   }});
+
+  cases.push_back({"file", [](const std::string& dir) {
+                     return LoggerBench(
+                         {std::make_shared<FileLogAppender>(dir + "/file.log")});
+                   }});
+
+  cases.push_back({"file/async", [](const std::string& dir) {
+                     return LoggerBench(
+                         {std::make_shared<FileLogAppender>(dir + "/file.log")},
+                         true);
+                   }});
+
+  cases.push_back({"mmap", [](const std::string& dir) {
+                     return LoggerBench({std::make_shared<MmapFileLogAppender>(
+                         dir + "/mmap.log")});
+                   }});
+
+  cases.push_back({"binlog", [](const std::string& dir) {
+                     auto logger = std::make_shared<BinLogger>(
+                         "bench", dir + "/bin.log", LogLevel::DEBUG,
+                         4 * 1024 * 1024);
+                     Bench bench;
+                     bench.op = [logger = logger.get()](int i) {
+                       LOG_BIN_INFO(*logger, "request id={} took {} ms path={}",
+                                    i, 0.25 * i, "/index.html");
+                     };
+                     bench.finish = [logger = logger.get()]() {
+                       logger->flush();
+                     };
+                     bench.dropped = [logger = logger.get()]() {
+                       return logger->getDroppedCount();
+                     };
+                     bench.state = logger;
+                     return bench;
+                   }});
+
+  // single thread micro benchmarks of the building blocks
+  cases.push_back({"formatter/format",
+                   [](const std::string&) {
+                     auto logger = std::make_shared<Logger>("bench");
+                     auto formatter = std::make_shared<LogFormatter>();
+                     auto event = std::make_shared<LogEvent>(
+                         LogLevel::INFO, __FILE__, __LINE__, 0, 1234, 0,
+                         GetCurrentUs());
+                     event->getStream() << "request id=" << 42;
+                     Bench bench;
+                     bench.op = [=](int) {
+                       std::string line = formatter->format(*logger, *event);
+                     };
+                     bench.state = logger;
+                     return bench;
+                   },
+                   false});
+
+  cases.push_back({"formatter/formatTo",
+                   [](const std::string&) {
+                     auto logger = std::make_shared<Logger>("bench");
+                     auto formatter = std::make_shared<LogFormatter>();
+                     auto event = std::make_shared<LogEvent>(
+                         LogLevel::INFO, __FILE__, __LINE__, 0, 1234, 0,
+                         GetCurrentUs());
+                     event->getStream() << "request id=" << 42;
+                     auto out = std::make_shared<LogStream>();
+                     Bench bench;
+                     bench.op = [=](int) {
+                       out->reset();
+                       formatter->formatTo(*out, *logger, *event);
+                     };
+                     bench.state = logger;
+                     return bench;
+                   },
+                   false});
+
+  cases.push_back({"json/escape_4k",
+                   [](const std::string&) {
+                     auto message = std::make_shared<std::string>(4096, 'a');
+                     (*message)[2048] = '"';
+                     auto out = std::make_shared<LogStream>();
+                     Bench bench;
+                     bench.op = [=](int) {
+                       out->reset();
+                       JsonLogFormatter::Escape(*out, *message);
+                     };
+                     bench.state = message;
+                     return bench;
+                   },
+                   false});
+
+  return cases;
+}
+
+static void CleanDir(const std::string& dir) {
+  if (DIR* d = opendir(dir.c_str())) {
+    while (struct dirent* entry = readdir(d)) {
+      if (entry->d_name[0] != '.') {
+        unlink((dir + "/" + entry->d_name).c_str());
+      }
+    }
+    closedir(d);
+  }
+}
+
+static BenchResult RunCase(const BenchCase& c, int threads, uint64_t lines,
+                           const std::string& dir) {
+  Bench bench = c.make(dir);
+  uint64_t perThread = std::max<uint64_t>(lines / threads, 1);
+
+  std::vector<std::vector<uint32_t>> latencies(threads);
+  std::vector<uint64_t> allocs(threads, 0);
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+
+  auto producer = [&](int t) {
+    std::vector<uint32_t>& samples = latencies[t];
+    samples.resize(perThread);
+    // first line sets up per thread state (event pool, buffers)
+    bench.op(0);
+    ready.fetch_add(1);
+    while (!go.load(std::memory_order_acquire)) {
+    }
+
+    uint64_t before = t_allocs;
+    for (uint64_t i = 0; i < perThread; i++) {
+      auto begin = std::chrono::steady_clock::now();
+      bench.op((int)i);
+      auto end = std::chrono::steady_clock::now();
+      samples[i] =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+              .count();
+    }
+    allocs[t] = t_allocs - before;
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back(producer, t);
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  auto begin = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  bench.finish();
+  auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+  uint64_t dropped = bench.dropped();
+  bench = Bench{};
+  CleanDir(dir);
+
+  std::vector<uint32_t> all;
+  all.reserve(perThread * threads);
+  uint64_t sum = 0;
+  uint64_t totalAllocs = 0;
+  for (int t = 0; t < threads; t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    totalAllocs += allocs[t];
+  }
+  for (uint32_t ns : all) {
+    sum += ns;
+  }
+  auto percentile = [&all](double p) -> uint64_t {
+    size_t k = std::min(all.size() - 1, (size_t)(p * all.size()));
+    std::nth_element(all.begin(), all.begin() + k, all.end());
+    return all[k];
+  };
+
+  BenchResult result;
+  result.name = c.name;
+  result.threads = threads;
+  result.lines = all.size();
+  result.linesPerSec = all.size() * 1e9 / wall;
+  result.nsPerOp = (double)sum / all.size();
+  result.p50 = percentile(0.50);
+  result.p99 = percentile(0.99);
+  result.p999 = percentile(0.999);
+  result.allocsPerLine = (double)totalAllocs / all.size();
+  result.dropped = dropped;
+  return result;
+}
+
+static void PrintHeader() {
+  std::cout << std::left << std::setw(22) << "case" << std::right
+            << std::setw(8) << "threads" << std::setw(14) << "lines/s"
+            << std::setw(10) << "ns/op" << std::setw(9) << "p50"
+            << std::setw(9) << "p99" << std::setw(10) << "p999"
+            << std::setw(13) << "allocs/line" << std::setw(10) << "dropped"
+            << std::endl;
+}
+
+static void PrintResult(const BenchResult& r) {
+  std::cout << std::left << std::setw(22) << r.name << std::right
+            << std::setw(8) << r.threads << std::setw(14) << std::fixed
+            << std::setprecision(0) << r.linesPerSec << std::setw(10)
+            << std::setprecision(1) << r.nsPerOp << std::setw(9) << r.p50
+            << std::setw(9) << r.p99 << std::setw(10) << r.p999
+            << std::setw(13) << std::setprecision(3) << r.allocsPerLine
+            << std::setw(10) << r.dropped << std::endl;
+}
+
+static void WriteJson(std::ostream& os, const BenchResult& r) {
+  os << "{\"case\":\"" << r.name << "\",\"threads\":" << r.threads
+     << ",\"lines\":" << r.lines << std::fixed << std::setprecision(1)
+     << ",\"lines_per_sec\":" << r.linesPerSec
+     << ",\"ns_per_op\":" << r.nsPerOp << ",\"p50_ns\":" << r.p50
+     << ",\"p99_ns\":" << r.p99 << ",\"p999_ns\":" << r.p999
+     << std::setprecision(3) << ",\"allocs_per_line\":" << r.allocsPerLine
+     << ",\"dropped\":" << r.dropped << "}" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  uint64_t lines = 200000;
+  std::vector<int> threadCounts = {1, 2, 4, 8, 16, 32, 64};
+  std::string filter;
+  std::string jsonPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      threadCounts.clear();
+      std::string list = argv[++i];
+      for (size_t pos = 0; pos < list.size();) {
+        size_t comma = list.find(',', pos);
+        threadCounts.push_back(std::atoi(list.substr(pos, comma).c_str()));
+        pos = comma == std::string::npos ? list.size() : comma + 1;
+      }
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else {
+      lines = std::strtoull(arg.c_str(), nullptr, 10);
+    }
+  }
+
+  char dirTemplate[] = "/tmp/cosmic_bench_XXXXXX";
+  if (!mkdtemp(dirTemplate)) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  std::string dir = dirTemplate;
+
+  std::ofstream json;
+  if (!jsonPath.empty()) {
+    json.open(jsonPath);
+  }
+
+  PrintHeader();
+  for (const auto& c : MakeCases()) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    for (int threads : threadCounts) {
+      if (threads < 1 || (!c.threaded && threads > 1)) {
+        continue;
+      }
+      BenchResult result = RunCase(c, threads, lines, dir);
+      PrintResult(result);
+      if (json.is_open()) {
+        WriteJson(json, result);
+      }
+    }
+  }
+
+  rmdir(dir.c_str());
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "cosmic.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <time.h>
+
+#ifdef COSMIC_HAVE_TSC
+
+// CLOCK_REALTIME shifted by s_step, stands in for NTP or settimeofday
+static std::atomic<int64_t> s_step{0};
+
+static uint64_t SteppedWallNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + s_step.load();
+}
+
+static int64_t WallErrorMs(cosmic::TscClock& clock) {
+  return ((int64_t)clock.nowNs() - (int64_t)SteppedWallNs()) / 1000000;
+}
+
+// a step of the wall clock moves the base, never the tick rate
+void test_step() {
+  cosmic::TscClock clock{SteppedWallNs};
+  if (!clock.enabled()) {
+    std::cout << "no invariant tsc, skipped" << std::endl;
+    return;
+  }
+  double rate = clock.getNsPerTick();
+  for (int64_t step : {-1000000000ll, 2000000000ll}) {
+    s_step.fetch_add(step);
+    // past the resync window
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    clock.nowNs();
+    double drift = std::fabs(clock.getNsPerTick() - rate) / rate;
+    int64_t error = WallErrorMs(clock);
+    std::cout << "step " << step / 1000000 << "ms: ns/tick "
+              << clock.getNsPerTick() << " drift " << drift << " error "
+              << error << "ms" << std::endl;
+    if (drift > 0.01 || std::abs(error) > 5) {
+      abort();
+    }
+  }
+}
+
+#endif
+
+int main() {
+#ifdef COSMIC_HAVE_TSC
+  test_step();
+#endif
+  return 0;
+}
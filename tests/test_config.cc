@@ -1,6 +1,16 @@
 #include "cosmic.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
 #include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 std::shared_ptr<cosmic::ConfigVar<int>> g_int_val_cfg =
     cosmic::Config::Lookup("system.port", (int)8080, "system port");
@@ -8,18 +18,236 @@ std::shared_ptr<cosmic::ConfigVar<int>> g_int_val_cfg =
 std::shared_ptr<cosmic::ConfigVar<float>> g_float_val_cfg =
     cosmic::Config::Lookup("system.value", (float)10.2f, "system value");
 
+// readers keep a snapshot while a writer replaces the value
+void test_snapshot() {
+  auto name = cosmic::Config::Lookup("system.name", std::string{"cosmic"},
+                                     "system name");
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  std::atomic<uint64_t> reloads{0};
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+      cosmic::ConfigVar<std::string>::Reader reader{*name};
+      uint64_t seen = 0;
+      while (!stop.load()) {
+        const std::string& value = reader.get();
+        if (value.empty()) {
+          abort();
+        }
+        if (name->getVersion() != seen) {
+          seen = name->getVersion();
+          reloads++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 1000; i++) {
+    name->setValue("cosmic-" + std::to_string(i));
+  }
+  stop.store(true);
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  LOG_INFO(ROOT_LOGGER()) << "system.name=" << *name->snapshot()
+                          << " version=" << name->getVersion()
+                          << " reader reloads=" << reloads.load();
+}
+
+// a user type without operator==
+struct Endpoint {
+  std::string host;
+  int port = 0;
+};
+
+template <> struct cosmic::ConfigConverter<Endpoint> {
+  static Endpoint FromNode(const YAML::Node& node) {
+    return Endpoint{node["host"].as<std::string>(), node["port"].as<int>()};
+  }
+  static YAML::Node ToNode(const Endpoint& v) {
+    YAML::Node node;
+    node["host"] = v.host;
+    node["port"] = v.port;
+    return node;
+  }
+};
+
+// without operator== every set notifies, an equal value included
+void test_no_equality() {
+  auto endpoint = cosmic::Config::Lookup("server.endpoint",
+                                         Endpoint{"localhost", 80}, "peer");
+  int calls = 0;
+  endpoint->addListener([&calls](const Endpoint&, const Endpoint&) { calls++; },
+                        cosmic::ConfigDelivery::SYNC);
+  endpoint->setValue(Endpoint{"localhost", 80});
+  endpoint->fromString("{host: example.com, port: 443}");
+  if (calls != 2 || endpoint->snapshot()->port != 443) {
+    abort();
+  }
+}
+
+// STL containers and scalars converted through YAML
+void test_converter() {
+  auto ports = cosmic::Config::Lookup("server.ports", std::vector<int>{80},
+                                      "listen ports");
+  auto hosts = cosmic::Config::Lookup(
+      "server.hosts", std::map<std::string, std::set<std::string>>{},
+      "virtual hosts");
+  auto ratio = cosmic::Config::Lookup("server.ratio", 0.5, "ratio");
+  auto enabled = cosmic::Config::Lookup("server.enabled", false, "enabled");
+
+  cosmic::Config::LoadFromYaml(YAML::Load(R"(
+server:
+  ports: [8080, 8081]
+  hosts:
+    api: [a.example.com, b.example.com]
+    web: [www.example.com]
+  ratio: 0.75
+  enabled: yes
+  unknown: 1
+)"));
+  if (ports->getValue() != std::vector<int>{8080, 8081} ||
+      hosts->getValue().at("api").size() != 2 || ratio->getValue() != 0.75 ||
+      !enabled->getValue()) {
+    abort();
+  }
+  // a bad value keeps the old one
+  if (ports->fromString("[1, x]") ||
+      ports->getValue() != std::vector<int>{8080, 8081}) {
+    abort();
+  }
+  LOG_INFO(ROOT_LOGGER()) << "server.ports=" << ports->toString();
+  LOG_INFO(ROOT_LOGGER()) << "server.hosts=" << hosts->toString();
+  LOG_INFO(ROOT_LOGGER()) << "server.ratio=" << ratio->toString()
+                          << " server.enabled=" << enabled->toString();
+}
+
+// only the edited key is applied again after the file changes
+void test_watcher() {
+  char dir[] = "/tmp/cosmic_config_XXXXXX";
+  if (!mkdtemp(dir)) {
+    abort();
+  }
+  std::string path = std::string{dir} + "/app.yaml";
+  std::ofstream(path) << "app:\n  threads: 4\n  name: first\n";
+
+  auto threads = cosmic::Config::Lookup("app.threads", 1, "worker threads");
+  auto name = cosmic::Config::Lookup("app.name", std::string{}, "app name");
+  cosmic::ConfigWatcher watcher{20};
+  watcher.watch(path);
+  uint64_t threadsVersion = threads->getVersion();
+  if (threads->getValue() != 4 || name->getValue() != "first") {
+    abort();
+  }
+
+  // a burst of writes, then an editor style replace
+  for (int i = 0; i < 5; i++) {
+    std::ofstream(path) << "app:\n  threads: 4\n  name: draft" << i << "\n";
+  }
+  std::ofstream(path + ".tmp") << "app:\n  threads: 4\n  name: second\n";
+  rename((path + ".tmp").c_str(), path.c_str());
+  for (int i = 0; i < 100 && name->getValue() != "second"; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (name->getValue() != "second" ||
+      threads->getVersion() != threadsVersion) {
+    abort();
+  }
+  LOG_INFO(ROOT_LOGGER()) << "app.name=" << name->getValue()
+                          << " reloads=" << watcher.getReloadCount();
+  unlink(path.c_str());
+  rmdir(dir);
+}
+
+// async listeners of one load run together on the dispatcher thread
+void test_listener() {
+  auto low = cosmic::Config::Lookup("limits.low", 1, "low limit");
+  auto high = cosmic::Config::Lookup("limits.high", 10, "high limit");
+  pid_t loader = cosmic::GetThreadId();
+  std::vector<std::string> calls; // the dispatcher thread only
+  std::atomic<int> syncCalls{0};
+
+  low->addListener([&](const int& oldValue, const int& newValue) {
+    if (cosmic::GetThreadId() == loader) {
+      abort();
+    }
+    calls.push_back("low " + std::to_string(oldValue) + "->" +
+                    std::to_string(newValue));
+  });
+  high->addListener([&](const int& oldValue, const int& newValue) {
+    calls.push_back("high " + std::to_string(oldValue) + "->" +
+                    std::to_string(newValue));
+  });
+  high->addListener(
+      [&](const int&, const int&) {
+        if (cosmic::GetThreadId() != loader) {
+          abort();
+        }
+        syncCalls++;
+      },
+      cosmic::ConfigDelivery::SYNC);
+  uint64_t removed =
+      low->addListener([](const int&, const int&) { abort(); });
+  low->delListener(removed);
+
+  cosmic::Config::LoadFromYaml(YAML::Load("limits: {low: 2, high: 20}"));
+  if (syncCalls.load() != 1) {
+    abort();
+  }
+  cosmic::ConfigDispatcher::Flush();
+  if (calls.size() != 2) {
+    abort();
+  }
+  for (const auto& call : calls) {
+    LOG_INFO(ROOT_LOGGER()) << "listener " << call;
+  }
+}
+
+// a listener still queued when main returns runs before the process exits
+void test_exit_drain(const char* self) {
+  std::string command = std::string{self} + " exit-drain";
+  FILE* child = popen(command.c_str(), "r");
+  char line[64] = {};
+  std::string output;
+  while (fgets(line, sizeof(line), child)) {
+    output += line;
+  }
+  if (pclose(child) != 0 || output != "listener ran\n") {
+    abort();
+  }
+}
+
+// the child of test_exit_drain
+int exit_drain() {
+  auto flag = cosmic::Config::Lookup("exit.flag", false, "exit flag");
+  flag->addListener([](const bool&, const bool&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    printf("listener ran\n");
+  });
+  flag->setValue(true);
+  return 0;
+}
+
 void test_yaml() {
   YAML::Node root = YAML::LoadFile("/home/liam/workspace/cosmic/conf/log.yaml");
   LOG_INFO(ROOT_LOGGER()) << root;
 }
 
-int main() {
+int main(int argc, char** argv) {
+  if (argc > 1 && std::string{argv[1]} == "exit-drain") {
+    return exit_drain();
+  }
   LOG_INFO(ROOT_LOGGER()) << g_int_val_cfg->getValue();
   LOG_INFO(ROOT_LOGGER()) << g_int_val_cfg->toString();
 
   LOG_INFO(ROOT_LOGGER()) << g_float_val_cfg->getValue();
   LOG_INFO(ROOT_LOGGER()) << g_float_val_cfg->toString();
 
+  test_snapshot();
+  test_converter();
+  test_watcher();
+  test_listener();
+  test_no_equality();
+  test_exit_drain(argv[0]);
   test_yaml();
   return 0;
 }
@@ -1,8 +1,24 @@
 #include "cosmic.h"
 
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
 #include <ctime>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 int main() {
   using namespace cosmic;
@@ -12,12 +28,22 @@ int main() {
       new StdoutLogAppender{LogLevel::INFO}};
   logger->addAppender(stdoutLogAppender);
 
+  int evaluated = 0;
+  LOG_DEBUG(*logger) << "disabled " << ++evaluated;
+  LOG_DEBUG_FMT(*logger, "disabled {}", ++evaluated);
+  std::cout << "logger level: " << (int)logger->getLevel()
+            << " debug evaluated: " << evaluated << std::endl;
+  stdoutLogAppender->setLogLevel(LogLevel::DEBUG);
+  LOG_DEBUG(*logger) << "enabled " << ++evaluated;
+  stdoutLogAppender->setLogLevel(LogLevel::INFO);
+
   std::shared_ptr<FileLogAppender> fileLogAppender{
       new FileLogAppender{"./log.txt", LogLevel::DEBUG}};
   // fileLogAppender->setFormatter("%d%m%d%n");
   logger->addAppender(fileLogAppender);
 
   std::cout << "Hello Logger" << std::endl;
+
   LOG_INFO(*logger) << "test macro info";
   LOG_ERROR(*logger) << "test macro error";
 
@@ -26,5 +52,499 @@ int main() {
   logger2->addAppender(fileLogAppender);
   LOG_INFO(*logger2) << "test manager";
   LOG_ERROR(*logger2) << "test manager";
+
+  // "system.net" writes through "system" until it has appenders
+  auto manager = LoggerManager::GetInstance();
+  auto system = manager->getLogger("system");
+  auto net = manager->getLogger("system.net");
+  std::cout << "system.net parent: " << net->getParent()->getName()
+            << " system parent: " << system->getParent()->getName()
+            << std::endl;
+  LOG_INFO(*net) << "test hierarchy via root";
+  system->addAppender(fileLogAppender);
+  LOG_DEBUG(*net) << "test hierarchy via system";
+  std::cout << "system.net level: " << (int)net->getLevel()
+            << " same logger: " << (manager->getLogger("system.net") == net)
+            << std::endl;
+
+  // structured fields, as key=value in text and as members in JSON
+  LOG_INFO(*logger).kv("user", 42).kv("ok", true).kv("path", "/a \"b\"")
+      << "test kv";
+  auto jsonAppender = std::make_shared<StdoutLogAppender>(
+      std::make_unique<JsonLogFormatter>(), LogLevel::INFO);
+  logger->addAppender(jsonAppender);
+  LOG_INFO(*logger).kv("latency", 1.5).kv("tab", "a\tb") << "test json\n";
+  logger->delAppender(jsonAppender);
+
+  // 2 lines, the second reports 4 suppressed
+  for (int i = 0; i < 10; i++) {
+    LOG_EVERY_N(*logger, LogLevel::INFO, 5) << "test every n " << i;
+  }
+  for (int i = 0; i < 10; i++) {
+    LOG_FIRST_N(*logger, LogLevel::INFO, 2) << "test first n " << i;
+    LOG_RATE_LIMITED(*logger, LogLevel::INFO, 3) << "test rate limited " << i;
+  }
+
+  // loggers built from YAML through Config, reloaded while other threads log
+  const char* conf = R"(
+logs:
+  - name: reload
+    level: info
+    formatter: "%p %c %m%n"
+    appender:
+      - type: StdoutLogAppender
+)";
+  Config::LoadFromYaml(YAML::Load(conf));
+  auto reload = manager->getLogger("reload");
+  LOG_INFO(*reload) << "test yaml config";
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.emplace_back([&stop, reload, t]() {
+      while (!stop.load()) {
+        LOG_DEBUG(*reload) << "test reload " << t;
+      }
+    });
+  }
+  for (int i = 0; i < 50; i++) {
+    reload->setAppenders({std::make_shared<FileLogAppender>(
+        "./log.txt", i % 2 ? LogLevel::DEBUG : LogLevel::ERROR)});
+  }
+  stop.store(true);
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  // ToNode writes every key FromNode reads, so a dump loads back unchanged
+  const char* full = R"(
+logs:
+  - name: roundtrip
+    level: debug
+    formatter: "%p %m%n"
+    appender:
+      - type: FileLogAppender
+        file: ./roundtrip.txt
+        flush_bytes: 4096
+        flush_interval_ms: 200
+        flush_level: warn
+        sync_interval_ms: 500
+        rotate_bytes: 1048576
+        rotate_interval_s: 3600
+        max_files: 3
+        compress: true
+        queue_depth: 1024
+        overflow: drop_below_level
+        drop_level: error
+      - type: MmapFileLogAppender
+        file: ./roundtrip_mmap
+        segment_size: 65536
+      - type: FlightRecorderLogAppender
+        file: ./roundtrip_flight.txt
+        capacity: 64
+        trigger_level: fatal
+      - type: SocketLogAppender
+        address: unix:./roundtrip.sock
+        level: info
+        formatter: json
+        batch_lines: 8
+        max_pending_lines: 100
+        reconnect_interval_ms: 20
+)";
+  Config::LoadFromYaml(YAML::Load(full));
+  auto logs = Config::LookupBase("logs");
+  std::string dumped = logs->toString();
+  for (const char* key :
+       {"flush_bytes", "flush_interval_ms", "flush_level", "sync_interval_ms",
+        "rotate_bytes", "rotate_interval_s", "max_files", "compress",
+        "queue_depth", "overflow", "drop_level", "segment_size", "capacity",
+        "trigger_level", "address", "batch_lines", "max_pending_lines",
+        "reconnect_interval_ms"}) {
+    if (dumped.find(key) == std::string::npos) {
+      abort();
+    }
+  }
+  YAML::Node reloaded;
+  reloaded["logs"] = YAML::Load(dumped);
+  Config::LoadFromYaml(reloaded);
+  if (logs->toString() != dumped) {
+    abort();
+  }
+  std::cout << "logs round trip:\n" << dumped << std::endl;
+
+  Config::LoadFromYaml(YAML::Load("logs: []"));
+  std::cout << "reload level after removal: " << (int)reload->getLevel()
+            << std::endl;
+
+  Logger recorded{"recorded"};
+  auto flightSink = std::make_shared<FileLogAppender>("./flight.txt");
+  auto recorder = std::make_shared<FlightRecorderLogAppender>(
+      flightSink, LogLevel::DEBUG, LogLevel::ERROR, 8);
+  FlightRecorderLogAppender::InstallSignalHandler();
+  recorded.addAppender(recorder);
+  std::atomic<int> flightStep{0};
+  std::thread background{[&recorded, &flightStep]() {
+    for (int i = 0; i < 20; i++) {
+      LOG_DEBUG(recorded) << "test flight background " << i;
+    }
+    // an exited thread's ring goes to the next new thread, stay alive
+    flightStep.store(1);
+    while (flightStep.load() != 2) {
+      std::this_thread::yield();
+    }
+  }};
+  while (flightStep.load() != 1) {
+    std::this_thread::yield();
+  }
+  for (int i = 0; i < 20; i++) {
+    LOG_DEBUG(recorded) << "test flight " << i;
+  }
+  std::cout << "flight dumped before error: " << recorder->getDumpedCount()
+            << std::endl;
+  LOG_ERROR(recorded) << "test flight error";
+  // 8 lines of each thread, the error included
+  std::cout << "flight dumped after error: " << recorder->getDumpedCount()
+            << std::endl;
+  flightStep.store(2);
+  background.join();
+
+  // a crash dumps the recorded lines without the sink nor the heap
+  unlink("./flight_crash.txt");
+  pid_t crashing = fork();
+  if (crashing == 0) {
+    Logger crashLogger{"crash"};
+    crashLogger.addAppender(std::make_shared<FlightRecorderLogAppender>(
+        std::make_shared<FileLogAppender>("./flight_crash.txt"),
+        LogLevel::DEBUG));
+    for (int i = 0; i < 5; i++) {
+      LOG_INFO(crashLogger) << "test flight crash " << i;
+    }
+    abort();
+  }
+  int crashStatus = 0;
+  waitpid(crashing, &crashStatus, 0);
+  std::ifstream crashFile{"./flight_crash.txt"};
+  int crashLines = 0;
+  for (std::string line; std::getline(crashFile, line);) {
+    crashLines += line.find("test flight crash") != std::string::npos;
+  }
+  if (!WIFSIGNALED(crashStatus) || WTERMSIG(crashStatus) != SIGABRT ||
+      crashLines != 5) {
+    abort();
+  }
+  std::cout << "flight crash lines: " << crashLines << std::endl;
+
+  // unix datagram collector, the appender starts before it exists
+  unlink("./log.sock");
+  SocketLogOptions socketOptions;
+  socketOptions.flushIntervalMs = 10;
+  socketOptions.reconnectIntervalMs = 10;
+  auto socketAppender = std::make_shared<SocketLogAppender>(
+      "unix:./log.sock", std::make_unique<LogFormatter>("%m"), LogLevel::DEBUG,
+      socketOptions);
+  int collector = socket(AF_UNIX, SOCK_DGRAM, 0);
+  struct sockaddr_un collectorAddr {};
+  collectorAddr.sun_family = AF_UNIX;
+  strcpy(collectorAddr.sun_path, "./log.sock");
+  bind(collector, (struct sockaddr*)&collectorAddr, sizeof(collectorAddr));
+  Logger socketLogger{"socket"};
+  socketLogger.addAppender(socketAppender);
+  for (int i = 0; i < 100; i++) {
+    LOG_INFO(socketLogger) << "test socket " << i;
+  }
+  // the unix queue holds few datagrams, the rest wait in the appender
+  char datagram[256];
+  int received = 0;
+  for (int spin = 0; received < 100 && spin < 1000; spin++) {
+    ssize_t n = recv(collector, datagram, sizeof(datagram), MSG_DONTWAIT);
+    if (n <= 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      continue;
+    }
+    if (++received == 100) {
+      std::cout << "last datagram: " << std::string_view(datagram, n)
+                << std::endl;
+    }
+  }
+  std::cout << "socket sent: " << socketAppender->getSentCount()
+            << " received: " << received
+            << " dropped: " << socketAppender->getDroppedCount() << std::endl;
+  close(collector);
+  unlink("./log.sock");
+
+  int udpCollector = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in udpAddr {};
+  udpAddr.sin_family = AF_INET;
+  udpAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t udpAddrLen = sizeof(udpAddr);
+  bind(udpCollector, (struct sockaddr*)&udpAddr, sizeof(udpAddr));
+  getsockname(udpCollector, (struct sockaddr*)&udpAddr, &udpAddrLen);
+  auto udpAppender = std::make_shared<SocketLogAppender>(
+      "udp:127.0.0.1:" + std::to_string(ntohs(udpAddr.sin_port)),
+      LogLevel::DEBUG);
+  socketLogger.setAppenders({udpAppender});
+  LOG_INFO(socketLogger) << "test udp";
+  socketLogger.flush();
+  ssize_t n = recv(udpCollector, datagram, sizeof(datagram), 0);
+  std::cout << "udp datagram: " << std::string_view(datagram, n);
+  close(udpCollector);
+
+  // a slow sink behind its own queue does not hold back the file appender
+  struct SlowLogAppender : LogAppender {
+    SlowLogAppender() : LogAppender(LogLevel::DEBUG) {}
+    void append(const LogEvent&, std::string_view) override {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  };
+  Logger queuedLogger{"queued"};
+  for (LogOverflow overflow :
+       {LogOverflow::DROP_NEWEST, LogOverflow::DROP_OLDEST,
+        LogOverflow::BLOCK, LogOverflow::DROP_BELOW_LEVEL}) {
+    AsyncLogOptions asyncOptions;
+    asyncOptions.queueDepth = 16;
+    asyncOptions.overflow = overflow;
+    auto slow = std::make_shared<AsyncLogAppender>(
+        std::make_shared<SlowLogAppender>(), asyncOptions);
+    queuedLogger.setAppenders({slow, fileLogAppender});
+    for (int i = 0; i < 100; i++) {
+      LOG_STREAM(queuedLogger, i % 10 ? LogLevel::INFO : LogLevel::ERROR)
+          << "test queued " << i;
+    }
+    slow->flush();
+    AsyncLogStats stats = slow->getStats();
+    std::cout << "overflow " << (int)overflow << " queued: " << stats.queued
+              << " written: " << stats.written
+              << " dropped: " << stats.dropped
+              << " blocked: " << stats.blocked
+              << " max latency us: " << stats.maxLatencyUs << std::endl;
+  }
+  queuedLogger.clearAppenders();
+
+  // pre-forked workers share one ring, one of them dies holding a slot
+  auto sharedRing = SharedLogRing::Create("", 1024);
+  auto sharedFile = std::make_shared<FileLogAppender>("./shared.txt");
+  {
+    SharedLogCollector collector{sharedRing, {sharedFile}};
+    std::vector<pid_t> workers;
+    for (int w = 0; w < 4; w++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        Logger worker{"worker"};
+        worker.addAppender(
+            std::make_shared<SharedLogAppender>(sharedRing, LogLevel::DEBUG));
+        for (int i = 0; i < 200; i++) {
+          LOG_INFO(worker) << "test shared " << w << " " << i;
+        }
+        if (w == 0) {
+          // reserve a slot and die before committing it
+          size_t slotSize = shmlog::kSlotHeader + sharedRing->getMaxLine();
+          char* base = (char*)mmap(
+              nullptr,
+              shmlog::kHeaderSize + sharedRing->getSlotCount() * slotSize,
+              PROT_READ | PROT_WRITE, MAP_SHARED, sharedRing->getFd(), 0);
+          uint64_t pos = ((shmlog::Header*)base)->tail.fetch_add(1);
+          auto* slot = (shmlog::Slot*)(base + shmlog::kHeaderSize +
+                                       (pos % sharedRing->getSlotCount()) *
+                                           slotSize);
+          slot->seq.store(shmlog::Writing(getpid()));
+        }
+        _exit(0);
+      }
+      workers.push_back(pid);
+    }
+    for (pid_t pid : workers) {
+      waitpid(pid, nullptr, 0);
+    }
+    sharedRing->push(LogLevel::INFO, GetCurrentUs(), "test shared last\n");
+    for (int spin = 0; spin < 100 && collector.getCollectedCount() < 801;
+         spin++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::cout << "shared collected: " << collector.getCollectedCount()
+              << " abandoned: " << sharedRing->getAbandonedCount()
+              << " dropped: " << sharedRing->getDroppedCount() << std::endl;
+    // 4 x 200 lines and the last one, the slot of the dead worker skipped
+    if (collector.getCollectedCount() != 801 ||
+        sharedRing->getAbandonedCount() != 1) {
+      abort();
+    }
+  }
+
+  // format strings are checked at compile time, e.g. a missing argument or
+  // a lone { does not build
+  LOG_INFO_FMT(*logger, "test fmt x={} y={} ok={} {{literal}}", 42, 0.1,
+               true);
+  LOG_WARN_FMT(*logger, "test fmt {} {}", std::string{"str"}, "chars");
+
+  // the widest integers fit the conversion buffer
+  {
+    LogStream stream;
+    stream << std::numeric_limits<__int128>::min() << ' '
+           << std::numeric_limits<unsigned __int128>::max();
+    if (stream.view() != "-170141183460469231731687303715884105728 "
+                         "340282366920938463463374607431768211455") {
+      abort();
+    }
+  }
+
+  Logger asyncLogger{"async"};
+  asyncLogger.addAppender(fileLogAppender);
+  asyncLogger.setAsync(1024);
+  for (int i = 0; i < 100; i++) {
+    LOG_INFO(asyncLogger) << "test async " << i;
+  }
+  asyncLogger.flush();
+  std::cout << "async queued: " << asyncLogger.getQueuedCount()
+            << " dropped: " << asyncLogger.getDroppedCount() << std::endl;
+
+  // many producers race for the queue, flush() must still see every line
+  struct CountingLogAppender : LogAppender {
+    CountingLogAppender() : LogAppender(LogLevel::DEBUG) {}
+    void append(const LogEvent&, std::string_view) override { count++; }
+    std::atomic<uint64_t> count{0};
+  };
+  auto runProducers = [](Logger& target) {
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 8; t++) {
+      producers.emplace_back([&target, t]() {
+        for (int i = 0; i < 2000; i++) {
+          LOG_INFO(target) << "test producers " << t << " " << i;
+        }
+      });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+  };
+  for (int round = 0; round < 5; round++) {
+    auto counting = std::make_shared<CountingLogAppender>();
+    Logger stressLogger{"stress"};
+    stressLogger.addAppender(counting);
+    stressLogger.setAsync(1 << 16);
+    runProducers(stressLogger);
+    stressLogger.flush();
+    if (counting->count.load() != 8 * 2000) {
+      abort();
+    }
+
+    auto countingSink = std::make_shared<CountingLogAppender>();
+    AsyncLogOptions blockOptions;
+    blockOptions.overflow = LogOverflow::BLOCK;
+    auto queued =
+        std::make_shared<AsyncLogAppender>(countingSink, blockOptions);
+    Logger appenderLogger{"stress_appender"};
+    appenderLogger.addAppender(queued);
+    runProducers(appenderLogger);
+    queued->flush();
+    if (countingSink->count.load() != 8 * 2000) {
+      abort();
+    }
+    appenderLogger.clearAppenders();
+  }
+  std::cout << "async producers flushed" << std::endl;
+
+  // switching to async while producers log loses no line
+  {
+    auto counting = std::make_shared<CountingLogAppender>();
+    Logger switching{"switching"};
+    switching.addAppender(counting);
+    std::thread switcher{[&switching]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      switching.setAsync(1 << 16);
+    }};
+    runProducers(switching);
+    switcher.join();
+    switching.flush();
+    if (!switching.isAsync() || counting->count.load() != 8 * 2000) {
+      abort();
+    }
+  }
+
+  // a producer blocked on a full queue sits in a reader section, swapping
+  // the appenders of another logger must not wait for it
+  {
+    struct GateLogAppender : LogAppender {
+      GateLogAppender() : LogAppender(LogLevel::DEBUG) {}
+      void append(const LogEvent&, std::string_view) override {
+        while (!open.load()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      std::atomic<bool> open{false};
+    };
+    auto gate = std::make_shared<GateLogAppender>();
+    AsyncLogOptions blockOptions;
+    blockOptions.queueDepth = 4;
+    blockOptions.overflow = LogOverflow::BLOCK;
+    auto blocking = std::make_shared<AsyncLogAppender>(gate, blockOptions);
+    Logger stuck{"stuck"};
+    stuck.addAppender(blocking);
+    std::atomic<int> logged{0};
+    std::thread producer{[&stuck, &logged]() {
+      for (int i = 0; i < 16; i++) {
+        LOG_INFO(stuck) << "test blocked " << i;
+        logged++;
+      }
+    }};
+    while (blocking->getStats().blocked == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Logger swapped{"swapped"};
+    std::atomic<bool> swappedAll{false};
+    std::thread swapper{[&swapped, &swappedAll]() {
+      for (int i = 0; i < 10; i++) {
+        swapped.setAppenders({std::make_shared<CountingLogAppender>()});
+      }
+      swappedAll.store(true);
+    }};
+    for (int i = 0; i < 1000 && !swappedAll.load(); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    bool swappedWhileBlocked = swappedAll.load();
+    gate->open.store(true);
+    swapper.join();
+    producer.join();
+    if (!swappedWhileBlocked || logged.load() != 16) {
+      abort();
+    }
+    stuck.clearAppenders();
+  }
+
+  // segments cannot be created while the directory is gone, writers drop
+  // lines instead of waiting on the roll, and resume once it is back
+  {
+    mkdir("./mmap_test", 0755);
+    MmapFileLogAppender mmapAppender{"./mmap_test/log", LogLevel::DEBUG,
+                                     4096};
+    LogEvent event{LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0, 0};
+    std::string line(100, 'x');
+    line.back() = '\n';
+    rename("./mmap_test", "./mmap_test.gone");
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++) {
+      writers.emplace_back([&]() {
+        for (int i = 0; i < 200; i++) {
+          mmapAppender.append(event, line);
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    if (mmapAppender.getDroppedCount() == 0) {
+      abort();
+    }
+    rename("./mmap_test.gone", "./mmap_test");
+    uint64_t dropped = mmapAppender.getDroppedCount();
+    bool resumed = false;
+    for (int i = 0; i < 50 && !resumed; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      uint64_t before = mmapAppender.getDroppedCount();
+      mmapAppender.append(event, line);
+      resumed = mmapAppender.getDroppedCount() == before;
+    }
+    if (!resumed) {
+      abort();
+    }
+    std::cout << "mmap dropped " << dropped << std::endl;
+  }
   return 0;
 }
@@ -0,0 +1,38 @@
+#include "cosmic/shmlog.h"
+
+#include <csignal>
+#include <iostream>
+#include <unistd.h>
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void OnStop(int) { s_stop = 1; }
+
+// usage: cosmic-logcollect <shm name> <file> [slots]
+// creates the ring, workers attach with SharedLogRing::Open(name)
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "usage: " << argv[0] << " <shm name> <file> [slots]"
+              << std::endl;
+    return 2;
+  }
+  std::string name = argv[1];
+  size_t slots = argc > 3 ? std::stoul(argv[3])
+                          : cosmic::SharedLogRing::kDefaultSlotCount;
+
+  signal(SIGINT, OnStop);
+  signal(SIGTERM, OnStop);
+  {
+    auto ring = cosmic::SharedLogRing::Create(name, slots);
+    auto file = std::make_shared<cosmic::FileLogAppender>(argv[2]);
+    cosmic::SharedLogCollector collector{ring, {file}};
+    while (!s_stop) {
+      pause();
+    }
+    std::cerr << "collected " << collector.getCollectedCount() << " dropped "
+              << ring->getDroppedCount() << " abandoned "
+              << ring->getAbandonedCount() << std::endl;
+  }
+  cosmic::SharedLogRing::Unlink(name);
+  return 0;
+}
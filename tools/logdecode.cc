@@ -0,0 +1,26 @@
+#include "cosmic/binlog.h"
+
+#include <iostream>
+
+// usage: cosmic-logdecode <file> [pattern]
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+    return 2;
+  }
+
+  cosmic::BinLogReader reader{argv[1]};
+  if (!reader.isValid()) {
+    std::cerr << argv[1] << ": not a cosmic binary log" << std::endl;
+    return 1;
+  }
+
+  cosmic::LogFormatter formatter;
+  if (argc > 2) {
+    formatter.setPattern(argv[2]);
+  }
+  if (!reader.decode(formatter, std::cout)) {
+    std::cerr << argv[1] << ": truncated record at the end" << std::endl;
+  }
+  return 0;
+}